@@ -1,8 +1,12 @@
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <vector>
 #include "AutoUpdaterLib.h"
+#include "UpdaterDaemon.h"
+#include "BlockSync.h"
+#include "FileFetch.h"
+#include "FileHash.h"
+#include "LineIO.h"
 
 // c++ standard library
 
@@ -12,67 +16,112 @@ using std::endl;
 using std::string;
 using std::vector;
 
-// Takes user input and streams it into the file.
-void takeInput(std::fstream* file) {
+// Takes user input and buffers it into the file.
+void takeInput(LineWriter* file) {
 	string input;
 	cout << "Please type in a word: ";
 	cin >> input;
-	*file << input;
+	file->writeLine(input);
 }
 
-int main() {
+int main(int argc, char* argv[]) {
 
-	// Showcase of autoupdater.
-	auto Updater = new AutoUpdater(Version("1.0"),
-		"https://raw.githubusercontent.com/DanielHeath1234/AIE-AutoUpdater/master/version", 
-		"https://github.com/DanielHeath1234/Updater-Showcase/archive/master.zip");
-	delete Updater;
-
-	std::fstream file;
-	file.open("file.txt", std::ios_base::out);
+	const string versionURL = "https://raw.githubusercontent.com/DanielHeath1234/AIE-AutoUpdater/master/version";
+	const string downloadURL = "https://github.com/DanielHeath1234/Updater-Showcase/archive/master.zip";
 
-	// Write input to file
-	if (file.is_open()) { // Check if file is okay
-		for (size_t i = 0; i < 4; i++) {
-			takeInput(&file);
-			file << endl;
+	// Release side. Writes the block file clients use to reuse blocks they already have.
+	// Publish it next to the artifact as <artifact>.blocks.
+	if (argc > 2 && string(argv[1]) == "--make-blocks") {
+		string artifact(argv[2]);
+		string blockFile = (argc > 3) ? string(argv[3]) : artifact + BLOCK_FILE_EXTENSION;
+		if (BlockSync::writeBlockFile(artifact, blockFile) != DU_SUCCESS) {
+			std::cerr << "Cannot write block file for " << artifact << endl;
+			return 1;
 		}
-		//file << input; // Write input to file
+		cout << "Wrote " << blockFile << endl;
+		return 0;
 	}
-	else {
-		std::cerr << "Cannot open file" << endl;
+
+	// Release side. Prints the line to add to the version file so mirror downloads can be verified.
+	if (argc > 2 && string(argv[1]) == "--hash-artifact") {
+		MappedFile file(argv[2]);
+		Sha256 hash;
+		unsigned char digest[SHA256_SIZE];
+		if (file.data() == NULL || !hash.update(file.data(), file.size()) || !hash.finish(digest)) {
+			std::cerr << "Cannot hash " << argv[2] << endl;
+			return 1;
+		}
+		cout << ARTIFACT_HASH_PREFIX << Sha256::toHex(digest) << endl;
+		return 0;
 	}
 
-	file.close();
+	// Release side. Writes the per-file manifest and a <sha256>.gz object for each file in a build.
+	// Publish the output directory and point fileManifestURL at its files.manifest.
+	if (argc > 3 && string(argv[1]) == "--make-manifest") {
+		if (FileFetch::writeManifest(argv[2], argv[3]) != DU_SUCCESS) {
+			std::cerr << "Cannot write manifest for " << argv[2] << endl;
+			return 1;
+		}
+		cout << "Wrote " << argv[3] << "\\" << FILE_MANIFEST_NAME << endl;
+		return 0;
+	}
 
-	// Reading something from a file into our programs memory
-	string fileContents;
-	file.open("file.txt", std::ios_base::in);
+	// Run as the long-lived updater service.
+	if (argc > 1 && string(argv[1]) == "--updater-daemon") {
+		UpdaterDaemon daemon(Version("1.0"), versionURL, downloadURL);
+		daemon.run();
+		return 0;
+	}
 
-	vector<string> fileStrings;
+	// Showcase of autoupdater.
+	// Ask the daemon first. It either has an update ready to activate or nothing pending.
+	// Only check inline when no daemon is running.
+	string pending;
+	switch (UpdaterDaemon::queryPending("default", &pending)) {
+	case DAEMON_UPDATE_READY: {
+		UpdaterSettings settings;
+		settings.activateStaged = true;
+		auto Updater = new AutoUpdater(Version("1.0"), versionURL, downloadURL, "", settings);
+		delete Updater;
+		break;
+	}
+	case DAEMON_UNAVAILABLE: {
+		auto Updater = new AutoUpdater(Version("1.0"), versionURL, downloadURL);
+		delete Updater;
+		break;
+	}
+	default:
+		break;
+	}
 
-	if (file.is_open()) {
-		//file >> fileContents;
-		//cout << fileContents << endl;
+	LineWriter writer;
 
-		while (!file.eof()) { // Keep grabbing lines until eof is reached (End Of File).
-			char fileLine[256];
-			file.getline(fileLine, 256); // getLine grabs a single line from the file
-			string fileLineString = fileLine; // Converting the charArray into a string
-			fileStrings.push_back(fileLineString);
+	// Write input to file
+	if (writer.open("file.txt")) { // Check if file is okay
+		for (size_t i = 0; i < 4; i++) {
+			takeInput(&writer);
 		}
 	}
 	else {
-		// Throwing exceptions
 		std::cerr << "Cannot open file" << endl;
 	}
 
-	file.close();
+	writer.close(); // Buffered lines are written out here.
+
+	// Reading something from a file into our programs memory.
+	// The file is mapped, and each line is a view into the mapping.
+	LineReader reader;
+
+	if (!reader.open("file.txt")) {
+		std::cerr << "Cannot open file" << endl;
+	}
 
-	for (size_t i = 0; i < fileStrings.size(); i++)
+	const vector<std::string_view>& fileLines = reader.getLines();
+	for (size_t i = 0; i < fileLines.size(); i++)
 	{
-		cout << fileStrings[i] << endl;
+		cout << fileLines[i] << '\n';
 	}
+	cout.flush();
 
 	system("pause");
 }
\ No newline at end of file
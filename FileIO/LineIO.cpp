@@ -0,0 +1,173 @@
+#include "LineIO.h"
+
+#include <cstdint>
+#include <cstring>
+#include <windows.h>
+
+LineReader::LineReader()
+	: m_file(INVALID_HANDLE_VALUE), m_mapping(NULL), m_view(NULL), m_size(0), m_isOpen(false)
+{
+
+}
+
+LineReader::~LineReader()
+{
+	close();
+}
+
+bool LineReader::open(const char* path)
+{
+	close();
+
+	m_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size))
+	{
+		close();
+		return false;
+	}
+
+	// The whole file is mapped in one view, so it has to fit in size_t. On Win32 the view
+	// also has to fit in the free address space, which MapViewOfFile reports below.
+	if ((unsigned long long)size.QuadPart > SIZE_MAX)
+	{
+		close();
+		return false;
+	}
+	m_size = (size_t)size.QuadPart;
+
+	// Empty files cannot be mapped, but are still a valid file with no lines.
+	if (m_size == 0)
+	{
+		m_isOpen = true;
+		return true;
+	}
+
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping == NULL)
+	{
+		close();
+		return false;
+	}
+
+	m_view = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (m_view == NULL)
+	{
+		close();
+		return false;
+	}
+
+	m_isOpen = true;
+	_SplitLines();
+	return true;
+}
+
+void LineReader::close()
+{
+	m_lines.clear();
+
+	if (m_view != NULL)
+		UnmapViewOfFile(m_view);
+	if (m_mapping != NULL)
+		CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = NULL;
+	m_view = NULL;
+	m_size = 0;
+	m_isOpen = false;
+}
+
+void LineReader::_SplitLines()
+{
+	const char *end = m_view + m_size;
+
+	// Reserve from the file size rather than counting lines, so the file is only read once.
+	// Files with shorter lines regrow the list, which costs far less than a second pass over the file.
+	m_lines.reserve(m_size / LINE_READER_EXPECTED_LENGTH + 1);
+
+	for (const char *p = m_view; p < end;)
+	{
+		const char *newline = (const char*)memchr(p, '\n', end - p);
+		const char *lineEnd = (newline != NULL) ? newline : end;
+
+		// Strip the carriage return of a CRLF line ending.
+		size_t length = lineEnd - p;
+		if (length > 0 && p[length - 1] == '\r')
+			length--;
+
+		m_lines.emplace_back(p, length);
+		p = (newline != NULL) ? newline + 1 : end;
+	}
+}
+
+LineWriter::LineWriter(size_t buffer_size)
+	: m_file(NULL), m_buffer(buffer_size), m_used(0)
+{
+
+}
+
+LineWriter::~LineWriter()
+{
+	close();
+}
+
+bool LineWriter::open(const char* path)
+{
+	close();
+	return fopen_s(&m_file, path, "wb") == 0 && m_file != NULL;
+}
+
+bool LineWriter::writeLine(std::string_view line)
+{
+	return _Write(line.data(), line.size()) && _Write("\n", 1);
+}
+
+bool LineWriter::flush()
+{
+	if (m_file == NULL)
+		return false;
+
+	if (m_used > 0 && fwrite(m_buffer.data(), m_used, 1, m_file) != 1)
+		return false;
+
+	m_used = 0;
+	return fflush(m_file) == 0;
+}
+
+bool LineWriter::close()
+{
+	if (m_file == NULL)
+		return true;
+
+	bool flushed = flush();
+	fclose(m_file);
+	m_file = NULL;
+	return flushed;
+}
+
+bool LineWriter::_Write(const char* data, size_t size)
+{
+	if (m_file == NULL)
+		return false;
+
+	// Data that won't fit is written through once the buffer has been emptied.
+	if (m_used + size > m_buffer.size())
+	{
+		if (m_used > 0 && fwrite(m_buffer.data(), m_used, 1, m_file) != 1)
+			return false;
+		m_used = 0;
+
+		if (size > m_buffer.size())
+			return fwrite(data, size, 1, m_file) == 1;
+	}
+
+	memcpy(m_buffer.data() + m_used, data, size);
+	m_used += size;
+	return true;
+}
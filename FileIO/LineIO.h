@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define LINE_WRITER_BUFFER_SIZE 65536
+#define LINE_READER_EXPECTED_LENGTH 64
+
+// Reads a whole file through a memory mapping and splits it into lines.
+// Lines are views into the mapping, so they are only valid while the reader is open.
+// The file is mapped in one view, so it must fit in the process's address space.
+class LineReader
+{
+public:
+	LineReader();
+	~LineReader();
+
+	bool open(const char* path);
+	void close();
+
+	inline const std::vector<std::string_view>& getLines() const { return m_lines; }
+	inline size_t getSize() const { return m_size; }
+	inline bool isOpen() const { return m_isOpen; }
+
+private:
+	void _SplitLines();
+
+	void *m_file;
+	void *m_mapping;
+	const char *m_view;
+	size_t m_size;
+	bool m_isOpen;
+
+	std::vector<std::string_view> m_lines;
+};
+
+// Buffers lines in memory and only writes them out when the buffer fills,
+// on flush() or on close().
+class LineWriter
+{
+public:
+	LineWriter(size_t buffer_size = LINE_WRITER_BUFFER_SIZE);
+	~LineWriter();
+
+	bool open(const char* path);
+	bool writeLine(std::string_view line);
+	bool flush();
+	bool close();
+
+	inline bool isOpen() const { return m_file != NULL; }
+
+private:
+	bool _Write(const char* data, size_t size);
+
+	FILE *m_file;
+	std::vector<char> m_buffer;
+	size_t m_used;
+};
@@ -1,16 +1,31 @@
 #include "AutoUpdaterLib.h"
-#include "zlib\unzip.h"
+#include "BlockSync.h"
+#include "FileHash.h"
+#include "PluginRegistry.h"
+#include "PathFilter.h"
+#include "FileFetch.h"
+#include "ZipInflate.h"
 
 #include <curl/curl.h>
 #include <direct.h>
+#include <io.h>
 #include <windows.h>
 #include <algorithm>
 #include <iomanip>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <chrono>
+#include <climits>
+#include <memory>
+#include <sstream>
+#include <random>
 
 using std::string;
 
-AutoUpdater::AutoUpdater(Version cur_version, const string version_url, const string download_url, const char* process_location)
-	: m_version(&cur_version)
+AutoUpdater::AutoUpdater(Version cur_version, const string version_url, const string download_url, const char* process_location,
+	UpdaterSettings settings)
+	: m_version(&cur_version), m_settings(settings), m_cleanupStop(false)
 {
 	// Copies const string into char array for use in CURL.
 	strncpy_s(m_versionURL, version_url.c_str(), sizeof(m_versionURL));
@@ -45,15 +60,65 @@ AutoUpdater::AutoUpdater(Version cur_version, const string version_url, const st
 
 AutoUpdater::~AutoUpdater()
 {
+	stopCleanup();
+}
+
+void AutoUpdater::stopCleanup()
+{
+	// Whatever the background thread hasn't deleted is already saved for the next start.
+	{
+		std::lock_guard<std::mutex> lock(m_cleanupMutex);
+		m_cleanupStop = true;
+	}
+	m_cleanupWake.notify_all();
 
+	if (m_cleanupThread.joinable())
+		m_cleanupThread.join();
 }
 
 int AutoUpdater::run()
+{
+	int value = _Update();
+
+	// Work left over by an earlier cleanup is picked up on every start, not only after an install.
+	// The daemon runs alongside the application, so it leaves it to the application.
+	if (!m_cleanupRan && !m_settings.stageOnly)
+		_RunPendingCleanup();
+
+	return value;
+}
+
+int AutoUpdater::_Update()
 {
 	// Keep .0 on the end of float when outputting.
 	std::cout << std::fixed << std::setprecision(1);
 	errno_t value = UPDATER_SUCCESS;
 
+	// The daemon runs alongside the application, so it leaves recovery and hot reload
+	// activation to it. A journal seen from the daemon may belong to an install in progress.
+	if (!m_settings.stageOnly)
+	{
+		// Roll back or finish an install that was interrupted before its commit record was written.
+		value = _RecoverInstall();
+		if (value != I_SUCCESS)
+			return value;
+
+		// Put hot reloaded libraries in place under their own names while nothing has them loaded.
+		_ActivateHotReload();
+	}
+
+	// Install an update prepared by the updater daemon.
+	if (m_settings.activateStaged)
+		return _RunStaged();
+
+	// Jittered check scheduling.
+	if (m_settings.checkJitterMs > 0)
+	{
+		std::random_device seed;
+		std::uniform_int_distribution<unsigned int> jitter(0, m_settings.checkJitterMs);
+		std::this_thread::sleep_for(std::chrono::milliseconds(jitter(seed)));
+	}
+
 	// Downloads version number.
 	value = downloadVersionNumber();
 	if (value != VN_SUCCESS)
@@ -63,13 +128,55 @@ int AutoUpdater::run()
 	if (!checkForUpdate())
 		return UPDATER_NO_UPDATE;
 
+	// Prepare the update in the background without installing it.
+	if (m_settings.stageOnly)
+	{
+		// The application is installing from the temp directory. Try again on the next check.
+		TempDirLock lock(m_directory, 0);
+		if (!lock.isLocked())
+			return UPDATER_NO_UPDATE;
+
+		string staged;
+		if (readStagedMarker(m_downloadDIR, &staged, NULL, NULL) && staged == m_newVersion->getVersionString())
+			return UPDATER_SUCCESS;
+
+		// The old marker goes first, so it never describes a half replaced staging directory.
+		// Anything left from an older version is cleared with it.
+		std::error_code ec;
+		fs::remove(string(m_downloadDIR) + STAGED_MARKER_NAME, ec);
+		fs::remove_all(m_downloadDIR, ec);
+
+		value = downloadUpdate();
+		if (value != DU_SUCCESS)
+			return value;
+
+		if (!m_filesFetched)
+		{
+			value = unZipUpdate();
+			if (value != UZ_SUCCESS)
+				return value;
+		}
+
+		return _WriteStagedMarker();
+	}
+
 	char input;
 	std::cout << "Would you like to update? (y,n)" << std::endl;
 	std::cin >> input;
 
+	// Downloading, unzipping and installing all go through the temp directory the daemon stages into.
+	std::unique_ptr<TempDirLock> lock;
+
 	switch (input)
 	{
 	case 'y':
+		lock.reset(new TempDirLock(m_directory, TEMP_LOCK_TIMEOUT_MS));
+		if (!lock->isLocked())
+		{
+			m_flags.push_back(new Flag("Updater daemon is still staging an update.", UPDATER_LOCK_ERROR));
+			return UPDATER_LOCK_ERROR;
+		}
+
 		system("cls");
 
 		// Download the update.
@@ -78,11 +185,14 @@ int AutoUpdater::run()
 		if (value != DU_SUCCESS)
 			return value;
 
-		// Unzip the update.
-		std::cout << std::endl << "Unzipping update please wait..." << std::endl << std::endl;
-		value = unZipUpdate();
-		if (value != UZ_SUCCESS)
-			return value;
+		// Unzip the update. Per-file updates arrive already extracted.
+		if (!m_filesFetched)
+		{
+			std::cout << std::endl << "Unzipping update please wait..." << std::endl << std::endl;
+			value = unZipUpdate();
+			if (value != UZ_SUCCESS)
+				return value;
+		}
 
 		// Install the update.
 		std::cout << std::endl << "Installing update please wait..." << std::endl << std::endl;
@@ -91,10 +201,10 @@ int AutoUpdater::run()
 			return value;
 
 		// Cleanup.
-		/*std::cout << std::endl << "Cleaning up..." << std::endl << std::endl;
+		std::cout << std::endl << "Cleaning up..." << std::endl << std::endl;
 		value = cleanup();
 		if (value != CU_SUCCESS)
-			return value;*/
+			return value;
 
 			// Update was successful.
 		std::cout << std::endl << "Update Successful." << std::endl << std::endl;
@@ -113,6 +223,120 @@ int AutoUpdater::run()
 	return UPDATER_ERROR;
 }
 
+TempDirLock::TempDirLock(const string& directory, unsigned int timeout_ms)
+	: m_handle(NULL)
+{
+	// No sharing, so a second open fails until the holder closes the handle.
+	string lockPath = directory + "\\" + TEMP_LOCK_NAME;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	while (true)
+	{
+		HANDLE handle = CreateFileA(lockPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_HIDDEN, NULL);
+		if (handle != INVALID_HANDLE_VALUE)
+		{
+			m_handle = handle;
+			return;
+		}
+
+		if (GetLastError() != ERROR_SHARING_VIOLATION || std::chrono::steady_clock::now() >= deadline)
+			return;
+		std::this_thread::sleep_for(std::chrono::milliseconds(TEMP_LOCK_RETRY_MS));
+	}
+}
+
+TempDirLock::~TempDirLock()
+{
+	if (m_handle != NULL)
+		CloseHandle((HANDLE)m_handle);
+}
+
+int AutoUpdater::_RunStaged()
+{
+	// Everything was downloaded and extracted ahead of time, so this never waits on the network.
+	// If the daemon is still staging, nothing is ready and the launch carries on.
+	TempDirLock lock(m_directory, 0);
+	if (!lock.isLocked())
+		return UPDATER_NO_UPDATE;
+
+	string version;
+	if (!readStagedMarker(m_downloadDIR, &version, &m_extractedDIR, &m_updateFiles))
+		return UPDATER_NO_UPDATE;
+
+	m_newVersion = new Version(version);
+	if (m_newVersion->getError() != VN_SUCCESS)
+		return VN_ERROR;
+
+	std::cout << "Installing prepared update " << version << "..." << std::endl << std::endl;
+	errno_t value = installUpdate();
+	if (value != I_SUCCESS)
+		return value;
+
+	value = cleanup();
+	if (value != CU_SUCCESS)
+		return value;
+
+	std::cout << std::endl << "Update Successful." << std::endl << std::endl;
+	return UPDATER_SUCCESS;
+}
+
+int AutoUpdater::_WriteStagedMarker()
+{
+	// Written last and moved into place, so a marker only exists for a fully extracted update.
+	// Every file in the new version is listed, so activation knows which files are orphaned.
+	string marker = m_newVersion->getVersionString() + "\n" + m_extractedDIR.u8string() + "\n";
+	for (auto& file : m_updateFiles)
+		marker += file + "\n";
+
+	if (!_WriteDurableFile(string(m_downloadDIR) + STAGED_MARKER_NAME, marker))
+		return UPDATER_ERROR;
+
+	std::cout << "Update " << m_newVersion->getVersionString() << " staged." << std::endl;
+	return UPDATER_SUCCESS;
+}
+
+bool AutoUpdater::readStagedMarker(const string& download_dir, string* version, fs::path* extracted_dir, std::vector<string>* files)
+{
+	std::ifstream marker(download_dir + STAGED_MARKER_NAME);
+	string stagedVersion;
+	string stagedDir;
+	if (!std::getline(marker, stagedVersion) || !std::getline(marker, stagedDir) || stagedVersion.empty())
+		return false;
+
+	if (version != NULL)
+		*version = stagedVersion;
+	if (extracted_dir != NULL)
+		*extracted_dir = fs::u8path(stagedDir);
+	if (files != NULL)
+	{
+		files->clear();
+		string file;
+		while (std::getline(marker, file))
+		{
+			if (!file.empty())
+				files->push_back(file);
+		}
+	}
+	return true;
+}
+
+string AutoUpdater::processDirectory(const char* process_location)
+{
+	// Same folder _SetDirs uses for m_directory.
+	char exeLOC[MAX_PATH];
+	if (process_location == NULL || process_location[0] == '\0')
+		GetModuleFileName(NULL, exeLOC, sizeof(exeLOC));
+	else
+		strncpy_s(exeLOC, process_location, sizeof(exeLOC));
+
+	string dir(exeLOC);
+	return dir.substr(0, dir.find_last_of("/\\"));
+}
+
+string AutoUpdater::downloadDirectory(const char* process_location)
+{
+	return processDirectory(process_location) + "\\temp\\";
+}
+
 int AutoUpdater::downloadVersionNumber()
 {
 	errno_t err = 0;
@@ -137,8 +361,26 @@ int AutoUpdater::downloadVersionNumber()
 
 		curl_easy_cleanup(curl);
 
-		// Changes new-line with null-terminator.
-		std::replace(readBuffer.begin(), readBuffer.end(), '\n', '\0');
+		// Lines after the version number are optional download mirrors and the artifact's hash.
+		std::istringstream lines(readBuffer);
+		string line;
+		std::getline(lines, line);
+		string versionLine = line;
+		while (std::getline(lines, line))
+		{
+			line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+			if (line.compare(0, strlen(ARTIFACT_HASH_PREFIX), ARTIFACT_HASH_PREFIX) == 0)
+			{
+				m_artifactHash = line.substr(strlen(ARTIFACT_HASH_PREFIX));
+				std::transform(m_artifactHash.begin(), m_artifactHash.end(), m_artifactHash.begin(), ::tolower);
+			}
+			else if (!line.empty())
+				m_mirrors.push_back(Mirror(line));
+		}
+
+		// Changes carriage-return with null-terminator.
+		readBuffer = versionLine;
+		std::replace(readBuffer.begin(), readBuffer.end(), '\r', '\0');
 
 		// Attempt to initalise downloaded version string as type Version.
 		m_newVersion = new Version(readBuffer);
@@ -171,6 +413,31 @@ bool AutoUpdater::checkForUpdate()
 
 int AutoUpdater::downloadUpdate()
 {
+	// Fetch only the changed files when a per-file manifest is published.
+	if (!m_settings.fileManifestURL.empty())
+	{
+		if (_DownloadPerFile() == DU_SUCCESS)
+			return DU_SUCCESS;
+
+		std::cout << "Per-file update unavailable. Downloading full update." << std::endl;
+	}
+
+	// Reuse blocks from the current install when a block file is published.
+	if (m_settings.blockReuse)
+	{
+		if (_DownloadWithBlockReuse() == DU_SUCCESS)
+			return DU_SUCCESS;
+
+		std::cout << "Block reuse unavailable. Downloading full update." << std::endl;
+	}
+
+	// Race the listed mirrors instead of using the fixed download URL.
+	// Mirror URLs come from the version file, so their downloads must match its published hash.
+	if (!m_mirrors.empty() && m_artifactHash.size() == SHA256_SIZE * 2)
+		return _DownloadFromMirrors();
+	if (!m_mirrors.empty())
+		std::cout << "Mirrors listed without an artifact hash. Using the download URL." << std::endl;
+
 	CURL *curl;
 	FILE *fp;
 	errno_t err;
@@ -219,17 +486,407 @@ int AutoUpdater::downloadUpdate()
 
 		curl_easy_cleanup(curl);
 		fclose(fp);
+		if (!m_artifactHash.empty() && _VerifyArtifact() != DU_SUCCESS)
+			return DU_HASH_ERROR;
+
 		std::cout << std::endl << "Download Successful." << std::endl;
 		return DU_SUCCESS;
 	}
 	return DU_CURL_ERROR;
 }
 
+int AutoUpdater::_DownloadFromMirrors()
+{
+	// Checks if download directory exists and if not, creates it.
+	if (!fs::exists(m_downloadDIR))
+	{
+		std::cout << "Download path does not exist. Creating directory now." << std::endl << "Path: " << m_downloadDIR << std::endl;
+		fs::create_directory(m_downloadDIR);
+	}
+
+	// The fixed download URL is always a candidate alongside the listed mirrors.
+	if (std::none_of(m_mirrors.begin(), m_mirrors.end(), [this](const Mirror& m) { return m.url == m_downloadURL; }))
+		m_mirrors.push_back(Mirror(m_downloadURL));
+
+	_LoadMirrorScores();
+	_RaceMirrors();
+
+	// Try mirrors fastest first. A transfer that drops below the speed limit is
+	// aborted and resumed from the same offset on the next mirror.
+	FILE *fp = NULL;
+	if (fopen_s(&fp, m_downloadFILE, "wb") != 0 || fp == NULL)
+		return DU_ERROR_WRITE_TO_FILE;
+
+	CURLcode res = CURLE_OK;
+	for (auto& mirror : m_mirrors)
+	{
+		CURL *curl = curl_easy_init();
+		if (!curl)
+			continue;
+
+		curl_off_t offset = (curl_off_t)_ftelli64(fp);
+		std::cout << "Downloading from mirror: " << mirror.url << std::endl;
+
+		// Error pages are never written into the download.
+		curl_easy_setopt(curl, CURLOPT_URL, mirror.url.c_str());
+		curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+		curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+		curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+		curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, offset);
+		curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, (long)m_settings.mirrorLowSpeedLimit);
+		curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)m_settings.mirrorLowSpeedTime);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _WriteData);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+
+		long status = 0;
+		res = curl_easy_perform(curl);
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+		curl_easy_cleanup(curl);
+
+		// A resumed transfer must answer 206. Anything else sent the file from the start,
+		// so the bytes from this attempt are dropped.
+		if (res == CURLE_OK && status == (offset > 0 ? 206 : 200))
+			break;
+		if (res == CURLE_OK)
+		{
+			res = CURLE_HTTP_RETURNED_ERROR;
+			fflush(fp);
+			_chsize_s(_fileno(fp), offset);
+			_fseeki64(fp, offset, SEEK_SET);
+		}
+
+		// Penalise the mirror so it ranks lower next run.
+		std::cout << "Mirror failed (" << curl_easy_strerror(res) << "). Failing over." << std::endl;
+		mirror.score = (mirror.score <= 0.0 ? MIRROR_FAIL_PENALTY : mirror.score * 2.0 + MIRROR_FAIL_PENALTY);
+		fflush(fp);
+	}
+
+	fclose(fp);
+	_SaveMirrorScores();
+
+	if (res != CURLE_OK)
+	{
+		m_flags.push_back(new Flag(curl_easy_strerror(res), DU_MIRROR_ERROR));
+		return DU_MIRROR_ERROR;
+	}
+
+	if (_VerifyArtifact() != DU_SUCCESS)
+		return DU_HASH_ERROR;
+
+	std::cout << std::endl << "Download Successful." << std::endl;
+	return DU_SUCCESS;
+}
+
+int AutoUpdater::_DownloadPerFile()
+{
+	// Download the manifest.
+	string manifest;
+	long status = 0;
+
+	CURL *curl = curl_easy_init();
+	if (!curl)
+		return DU_CURL_ERROR;
+
+	curl_easy_setopt(curl, CURLOPT_URL, m_settings.fileManifestURL.c_str());
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _WriteCallback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &manifest);
+	CURLcode res = curl_easy_perform(curl);
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+	curl_easy_cleanup(curl);
+	if (res != CURLE_OK || status != 200)
+		return DU_MANIFEST_ERROR;
+
+	FileFetch fetch;
+	if (fetch.parseManifest(manifest) != DU_SUCCESS)
+		return DU_MANIFEST_ERROR;
+
+	// The same rules as archive updates, so excluded files are neither fetched nor installed.
+	fetch.applyFilter(PathFilter(m_settings.includeRules, m_settings.excludeRules));
+
+	// Compare against the installed files.
+	string dir(m_directory);
+	fs::path install = dir.substr(0, dir.find_last_of("/\\"));
+	size_t changed = fetch.selectChanged(install);
+	std::cout << changed << " of " << fetch.getEntries().size() << " files changed." << std::endl;
+
+	// Changed files are written where unZipUpdate would have extracted them, so installUpdate is unchanged.
+	m_extractedDIR = fs::path(m_downloadDIR) / "files";
+	std::error_code ec;
+	fs::create_directories(_LongPath(m_extractedDIR), ec);
+
+	string manifestURL(m_settings.fileManifestURL);
+	string baseURL = manifestURL.substr(0, manifestURL.find_last_of('/') + 1);
+	int error = fetch.fetch(baseURL, _LongPath(m_extractedDIR), m_settings.fetchMaxStreams);
+	if (error != DU_SUCCESS)
+	{
+		m_flags.push_back(new Flag("Per-file fetch failed.", error));
+		fs::remove_all(m_extractedDIR, ec);
+		return error;
+	}
+
+	// Every file in the manifest belongs to the new version, fetched or not.
+	for (auto& entry : fetch.getEntries())
+	{
+		string path = entry.path;
+		std::replace(path.begin(), path.end(), '/', '\\');
+		m_updateFiles.push_back(path);
+	}
+
+	m_filesFetched = true;
+	std::cout << std::endl << "Download Successful." << std::endl;
+	return DU_SUCCESS;
+}
+
+int AutoUpdater::_DownloadWithBlockReuse()
+{
+	// Download the block file published next to the artifact.
+	string blockURL(m_downloadURL);
+	blockURL += BLOCK_FILE_EXTENSION;
+	string blockFile;
+	long status = 0;
+
+	CURL *curl = curl_easy_init();
+	if (!curl)
+		return DU_CURL_ERROR;
+
+	curl_easy_setopt(curl, CURLOPT_URL, blockURL.c_str());
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _WriteCallback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &blockFile);
+	CURLcode res = curl_easy_perform(curl);
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+	if (res != CURLE_OK || status != 200)
+	{
+		curl_easy_cleanup(curl);
+		return DU_BLOCK_FILE_ERROR;
+	}
+
+	BlockSync sync;
+	if (sync.parseBlockFile(blockFile) != DU_SUCCESS)
+	{
+		curl_easy_cleanup(curl);
+		return DU_BLOCK_FILE_ERROR;
+	}
+
+	if (!fs::exists(m_downloadDIR))
+		fs::create_directory(m_downloadDIR);
+
+	FILE *fp = NULL;
+	if (fopen_s(&fp, m_downloadFILE, "wb+") != 0 || fp == NULL)
+	{
+		curl_easy_cleanup(curl);
+		return DU_ERROR_WRITE_TO_FILE;
+	}
+
+	// The artifact kept from the last install shares most of its compressed blocks with this one,
+	// so it is scanned first. The installed files are extracted content and rarely match.
+	fs::path previous = string(m_directory) + "\\" + PREVIOUS_ARTIFACT_NAME;
+	std::error_code ec;
+	if (fs::is_regular_file(previous, ec) && sync.scanSeed(previous, fp) != DU_SUCCESS)
+	{
+		curl_easy_cleanup(curl);
+		fclose(fp);
+		return DU_BLOCK_FILE_ERROR;
+	}
+
+	// Scan the installed files, including .bak files from earlier updates, for blocks we already have.
+	string dir(m_directory);
+	fs::path install = dir.substr(0, dir.find_last_of("/\\"));
+	fs::path temp = fs::path(m_downloadDIR).parent_path();
+	for (auto iter = fs::recursive_directory_iterator(install, ec); iter != fs::recursive_directory_iterator() && !sync.isComplete(); iter.increment(ec))
+	{
+		if (ec)
+			break;
+
+		if (iter->path() == temp || iter->path().filename() == ".git")
+		{
+			iter.disable_recursion_pending();
+			continue;
+		}
+		if (iter->path() == previous)
+			continue;
+
+		if (fs::is_regular_file(iter->path(), ec) && sync.scanSeed(iter->path(), fp) != DU_SUCCESS)
+			break;
+	}
+
+	std::cout << "Reused " << sync.getFoundCount() << " of " << sync.getBlockCount() << " blocks from the current install." << std::endl;
+
+	// Fetch the missing ranges into place.
+	auto ranges = sync.getMissingRanges();
+	curl_easy_setopt(curl, CURLOPT_URL, m_downloadURL);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _WriteData);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+	for (auto& range : ranges)
+	{
+		string header = std::to_string(range.first) + "-" + std::to_string(range.second);
+		curl_easy_setopt(curl, CURLOPT_RANGE, header.c_str());
+		_fseeki64(fp, (long long)range.first, SEEK_SET);
+
+		// A server that ignores Range answers 200 with the whole artifact.
+		res = curl_easy_perform(curl);
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+		if (res != CURLE_OK || status != 206)
+		{
+			curl_easy_cleanup(curl);
+			fclose(fp);
+			return DU_BLOCK_RANGE_ERROR;
+		}
+	}
+
+	curl_easy_cleanup(curl);
+	fclose(fp);
+
+	if (sync.verify(m_downloadFILE) != DU_SUCCESS)
+	{
+		m_flags.push_back(new Flag("Block reuse produced an artifact that failed verification.", DU_BLOCK_VERIFY_ERROR));
+		return DU_BLOCK_VERIFY_ERROR;
+	}
+
+	std::cout << std::endl << "Download Successful. Fetched " << ranges.size() << " ranges." << std::endl;
+	return DU_SUCCESS;
+}
+
+void AutoUpdater::_RaceMirrors()
+{
+	// Known mirrors are ordered by score. Unscored mirrors go first so they get probed.
+	std::stable_sort(m_mirrors.begin(), m_mirrors.end(), [](const Mirror& a, const Mirror& b) { return a.score < b.score; });
+
+	CURLM *multi = curl_multi_init();
+	if (!multi)
+		return;
+
+	// Probe the top candidates with a staggered start, happy-eyeballs style.
+	const size_t count = (std::min)(m_mirrors.size(), (size_t)m_settings.mirrorRaceCount);
+	std::vector<CURL*> probes(count, nullptr);
+	auto nextStart = std::chrono::steady_clock::now();
+	size_t started = 0;
+	int winner = -1;
+	int running = 0;
+
+	do
+	{
+		// Start the next probe once the stagger delay has passed, or straight away if one failed.
+		auto now = std::chrono::steady_clock::now();
+		if (started < count && now >= nextStart)
+		{
+			CURL *probe = curl_easy_init();
+			curl_easy_setopt(probe, CURLOPT_URL, m_mirrors[started].url.c_str());
+			curl_easy_setopt(probe, CURLOPT_NOBODY, 1L);
+			curl_easy_setopt(probe, CURLOPT_FOLLOWLOCATION, 1L);
+			curl_easy_setopt(probe, CURLOPT_NOSIGNAL, 1);
+			curl_easy_setopt(probe, CURLOPT_TIMEOUT_MS, (long)MIRROR_PROBE_TIMEOUT_MS);
+			curl_easy_setopt(probe, CURLOPT_PRIVATE, (void*)started);
+			curl_multi_add_handle(multi, probe);
+			probes[started++] = probe;
+			nextStart = now + std::chrono::milliseconds(MIRROR_RACE_STAGGER_MS);
+		}
+
+		curl_multi_perform(multi, &running);
+
+		int queued = 0;
+		CURLMsg *msg;
+		while ((msg = curl_multi_info_read(multi, &queued)) != NULL)
+		{
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			void *index = nullptr;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &index);
+			Mirror& mirror = m_mirrors[(size_t)index];
+
+			long status = 0;
+			double seconds = 0.0;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &status);
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_TOTAL_TIME, &seconds);
+
+			// Scores are a smoothed probe latency in milliseconds.
+			double sample = (msg->data.result == CURLE_OK && status < 400) ? seconds * 1000.0 : MIRROR_FAIL_PENALTY;
+			mirror.score = (mirror.score <= 0.0) ? sample : mirror.score * (1.0 - MIRROR_SCORE_WEIGHT) + sample * MIRROR_SCORE_WEIGHT;
+
+			if (winner < 0 && sample < MIRROR_FAIL_PENALTY)
+				winner = (int)(size_t)index;
+			else if (sample >= MIRROR_FAIL_PENALTY)
+				nextStart = std::chrono::steady_clock::now();
+		}
+
+		if (winner >= 0)
+			break;
+
+		// Wake for the next staggered start if nothing finishes first.
+		auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(nextStart - std::chrono::steady_clock::now()).count();
+		if (started < count && wait <= 0)
+			continue;
+		curl_multi_poll(multi, NULL, 0, started < count ? (int)wait : MIRROR_RACE_STAGGER_MS, NULL);
+	} while (running > 0 || started < count);
+
+	// Probes still in flight lost the race.
+	for (auto probe : probes)
+	{
+		if (!probe)
+			continue;
+		curl_multi_remove_handle(multi, probe);
+		curl_easy_cleanup(probe);
+	}
+	curl_multi_cleanup(multi);
+
+	// Winner first, the rest by score.
+	if (winner >= 0)
+		std::rotate(m_mirrors.begin(), m_mirrors.begin() + winner, m_mirrors.begin() + winner + 1);
+	std::stable_sort(m_mirrors.begin() + (winner >= 0 ? 1 : 0), m_mirrors.end(),
+		[](const Mirror& a, const Mirror& b) { return a.score < b.score; });
+}
+
+int AutoUpdater::_VerifyArtifact()
+{
+	// A download that doesn't match the published hash is removed rather than unzipped.
+	bool matched = false;
+	{
+		MappedFile file(m_downloadFILE);
+		Sha256 hash;
+		unsigned char digest[SHA256_SIZE];
+		matched = file.data() != NULL && hash.update(file.data(), file.size()) &&
+			hash.finish(digest) && Sha256::toHex(digest) == m_artifactHash;
+	}
+	if (matched)
+		return DU_SUCCESS;
+
+	std::error_code ec;
+	fs::remove(m_downloadFILE, ec);
+	m_flags.push_back(new Flag("Downloaded update does not match the published hash.", DU_HASH_ERROR));
+	return DU_HASH_ERROR;
+}
+
+void AutoUpdater::_LoadMirrorScores()
+{
+	// Scores from previous runs. Each line is "<score> <url>".
+	std::ifstream file(string(m_directory) + "\\" + MIRROR_SCORES_NAME);
+	double score;
+	string url;
+	while (file >> score >> url)
+	{
+		for (auto& mirror : m_mirrors)
+		{
+			if (mirror.url == url)
+				mirror.score = score;
+		}
+	}
+}
+
+void AutoUpdater::_SaveMirrorScores()
+{
+	std::ofstream file(string(m_directory) + "\\" + MIRROR_SCORES_NAME, std::ios_base::trunc);
+	for (auto& mirror : m_mirrors)
+		file << mirror.score << " " << mirror.url << "\n";
+}
+
 int AutoUpdater::unZipUpdate()
 {
-	// Open the zip file
-	unzFile fOpen = unzOpen(m_downloadFILE);
-	unzFile *zipfile = &fOpen;
+	// Open the zip file. The 64-bit API handles Zip64 archives (over 4 GB or 65,535 entries).
+	unzFile zipfile = unzOpen64(m_downloadFILE);
 	if (zipfile == NULL)
 	{
 		//printf("%s", ": not found\n");
@@ -237,119 +894,158 @@ int AutoUpdater::unZipUpdate()
 	}
 
 	// Get info about the zip file
-	unz_global_info *global_info = new unz_global_info;
-	if (unzGetGlobalInfo(zipfile, global_info) != UNZ_OK)
+	unz_global_info64 global_info;
+	if (unzGetGlobalInfo64(zipfile, &global_info) != UNZ_OK)
 	{
 		//printf("could not read file global info\n");
-		unzClose(*zipfile);
+		unzClose(zipfile);
 		return UZ_GLOBAL_INFO_ERROR;
 	}
 
-	// Buffer to hold data read from the zip file.
-	char *read_buffer[READ_SIZE];
+#ifdef UPDATER_USE_LIBDEFLATE
+	// One decompressor is reused for every entry inflated in a single call.
+	std::unique_ptr<libdeflate_decompressor, decltype(&libdeflate_free_decompressor)> decompressor(
+		libdeflate_alloc_decompressor(), libdeflate_free_decompressor);
+	if (decompressor == NULL)
+	{
+		unzClose(zipfile);
+		return UZ_INFLATE_ERROR;
+	}
+#endif
+
+	// Rules are compiled once and checked against central directory names.
+	PathFilter filter(m_settings.includeRules, m_settings.excludeRules);
+	string rootName;
+
+	// Filename buffer, grown to fit the longest name seen so far.
+	// The central directory is read one entry at a time, so memory does not grow with entry count.
+	std::vector<char> filename(MAX_FILENAME + 1);
 
 	// Loop to extract all files
-	uLong i;
-	for (i = 0; i < (*global_info).number_entry; ++i)
+	ZPOS64_T i;
+	for (i = 0; i < global_info.number_entry; ++i)
 	{
 		// Get info about current file.
-		unz_file_info file_info;
-		char filename[MAX_FILENAME];
+		unz_file_info64 file_info;
+		if (unzGetCurrentFileInfo64(zipfile, &file_info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK)
+		{
+			unzClose(zipfile);
+			return UZ_FILE_INFO_ERROR;
+		}
+
+		if (file_info.size_filename + 1 > filename.size())
+			filename.resize(file_info.size_filename + 1);
 
-		if (unzGetCurrentFileInfo(
-			*zipfile,
+		if (unzGetCurrentFileInfo64(
+			zipfile,
 			&file_info,
-			filename,
-			MAX_FILENAME,
+			filename.data(),
+			(uLong)filename.size(),
 			NULL, 0, NULL, 0) != UNZ_OK)
 		{
-			unzClose(*zipfile);
+			unzClose(zipfile);
 			return UZ_FILE_INFO_ERROR;
 		}
+		filename[file_info.size_filename] = '\0';
 
-		char dirAndName[MAX_PATH] = "\0";
-		strncat_s(dirAndName, m_downloadDIR, sizeof(dirAndName));
-		strncat_s(dirAndName, filename, sizeof(dirAndName));
+		// Entry names are UTF-8 when general purpose flag bit 11 is set, and CP437 otherwise.
+		fs::path entryPath = _ZipEntryPath(filename.data(), (file_info.flag & 0x800) != 0);
+		string entryName = entryPath.u8string();
+		if (!PathFilter::isSafePath(entryName))
+		{
+			m_flags.push_back(new Flag("Unsafe entry name in archive: " + entryName, UZ_UNSAFE_PATH_ERROR));
+			unzClose(zipfile);
+			return UZ_UNSAFE_PATH_ERROR;
+		}
+		fs::path dirAndName = fs::path(m_downloadDIR) / entryPath;
 		if (i == 0)
-			strncpy_s(m_extractedDIR, dirAndName, sizeof(m_extractedDIR));
+		{
+			m_extractedDIR = dirAndName;
+			rootName = entryName;
+		}
+
+		fs::path outPath = _LongPath(dirAndName);
+
+		// Rules match against the name inside the archive's root folder.
+		string relativeName(entryName);
+		if (i > 0 && relativeName.compare(0, rootName.size(), rootName) == 0)
+			relativeName.erase(0, rootName.size());
 
 		// Check if this entry is a directory or file.
-		const size_t filename_length = strlen(filename);
-		if (filename[filename_length - 1] == dir_delimter)
+		const size_t filename_length = file_info.size_filename;
+		const bool isDirectory = filename_length > 0 && filename[filename_length - 1] == dir_delimter;
+		if (i > 0 && !filter.accepts(relativeName, isDirectory))
+		{
+			// Entry is excluded, so skip it without decompressing.
+			printf("skip:%s\n", filename.data());
+		}
+		else if (isDirectory)
 		{
 			// Entry is a directory, so create it.
-			printf("dir:%s\n", filename);
-			fs::create_directory(dirAndName);
+			printf("dir:%s\n", filename.data());
+			std::error_code ec;
+			fs::create_directories(outPath, ec);
 		}
 		else
 		{
 			// Entry is a file, so extract it.
-			printf("file:%s\n", filename);
-			if (unzOpenCurrentFile(*zipfile) != UNZ_OK)
-			{
-				unzClose(zipfile);
-				return UZ_FILE_INFO_ERROR;
-			}
+			printf("file:%s\n", filename.data());
+
+			// Directory entries are optional in zips, so make sure the parent exists.
+			std::error_code ec;
+			fs::create_directories(outPath.parent_path(), ec);
 
 			// Open a file to write out the data.
-			FILE *out;
-			errno_t err = 0;
-			err = fopen_s(&out, dirAndName, "wb");
+			FILE *out = NULL;
+			_wfopen_s(&out, outPath.wstring().c_str(), L"wb");
 			if (out == NULL)
 			{
-				unzCloseCurrentFile(*zipfile);
-				unzClose(*zipfile);
+				unzClose(zipfile);
 				return UZ_CANNOT_OPEN_DEST_FILE;
 			}
 
-			int error = UNZ_OK;
-			do
-			{
-				error = unzReadCurrentFile(*zipfile, read_buffer, READ_SIZE);
-				if (error < 0)
-				{
-					unzCloseCurrentFile(*zipfile);
-					unzClose(*zipfile);
-					return UZ_READ_FILE_ERROR;
-				}
-
-				// Write data to file.
-				if (error > 0)
-				{
-					if (fwrite(read_buffer, error, 1, out) != 1)
-					{
-						return UZ_FWRITE_ERROR;
-					}
-				}
-			} while (error > 0);
+			// Small deflated entries are inflated in one call, large ones are inflated and
+			// written on separate threads, and everything else is streamed.
+			int error = UZ_SUCCESS;
+#ifdef UPDATER_USE_LIBDEFLATE
+			if (file_info.compression_method == Z_DEFLATED && (file_info.flag & 1) == 0 &&
+				file_info.uncompressed_size <= m_settings.inflateBudget)
+				error = inflateWhole(zipfile, file_info, out, decompressor.get());
+			else
+#endif
+			if (file_info.uncompressed_size >= m_settings.pipelineThreshold)
+				error = inflatePipelined(zipfile, out);
+			else
+				error = inflateStreamed(zipfile, out);
 
 			fclose(out);
+			if (error != UZ_SUCCESS)
+			{
+				unzCloseCurrentFile(zipfile);
+				unzClose(zipfile);
+				return error;
+			}
 		}
 
-		unzCloseCurrentFile(*zipfile);
+		unzCloseCurrentFile(zipfile);
 
 		// Go the the next entry listed in the zip file.
-		if ((i + 1) < (*global_info).number_entry)
+		if ((i + 1) < global_info.number_entry)
 		{
-			int err = unzGoToNextFile(*zipfile);
+			int err = unzGoToNextFile(zipfile);
 			if (err != UNZ_OK)
 			{
 				if (err == UNZ_END_OF_LIST_OF_FILE)
-				{
-					std::cout << std::endl << "UnZip Successful." << std::endl;
-					unzClose(*zipfile);
-					delete global_info;
-					return UZ_SUCCESS;
-				}
-				unzClose(*zipfile);
-				delete global_info;
+					break;
+
+				unzClose(zipfile);
 				return UZ_CANNOT_READ_NEXT_FILE;
 			}
 		}
 	}
 
-	delete global_info;
-	unzClose(*zipfile);
+	unzClose(zipfile);
+	std::cout << std::endl << "UnZip Successful." << std::endl;
 
 	return UZ_SUCCESS;
 }
@@ -358,29 +1054,36 @@ int AutoUpdater::installUpdate()
 {
 	std::error_code ec;
 
+	// The update and install roots get the extended-length prefix, so every path below them
+	// can be longer than MAX_PATH.
+	fs::path update = _LongPath(m_extractedDIR);
+	string dir(m_directory);
+	std::size_t found = dir.find_last_of("/\\");
+	dir = dir.substr(0, found);
+	fs::path install = _LongPath(fs::path(dir));
+
+	// Record everything the install is about to touch before touching it.
+	if (m_settings.durableInstall && _WriteInstallJournal(update, install) != I_SUCCESS)
+		return I_COMMIT_ERROR;
+
 	// Rename process.
 	if (_RenameAndCopy(m_exeLOC) != I_SUCCESS)
 		return I_FS_RENAME_ERROR;
+	m_installedPaths.push_back(fs::path(m_exeLOC).u8string());
 
 	// Install update. (don't forget .exe)
-	fs::path update = m_extractedDIR;
-	string dir(m_directory);
-	std::size_t found = dir.find_last_of("/\\");
-	dir = dir.substr(0, found);
-	fs::path install = dir;
-
 	for (auto& p : fs::recursive_directory_iterator(update))
 	{
-		string path(p.path().string());
-		path.erase(0, strnlen_s(m_extractedDIR, sizeof(m_extractedDIR)));
+		fs::path relative = _RelativePath(p.path(), update);
+		string path = relative.u8string();
+		fs::path installPath = install / relative;
 
-		string installPath(install.string());
-		installPath += "\\";
-		installPath += path;
+		if (!fs::is_directory(p.path()))
+			m_updateFiles.push_back(path);
 
 		if (fs::is_directory(p.path())) // Directory
 		{
-			if (!fs::exists(p.path(), ec)) // Directory doesn't exist. Create it.
+			if (!fs::exists(installPath, ec)) // Directory doesn't exist. Create it.
 			{
 				std::cout << "Creating Directory: " << path << std::endl;
 				fs::create_directory(installPath, ec);
@@ -393,12 +1096,15 @@ int AutoUpdater::installUpdate()
 		}
 		else // File
 		{
-			// Do not overwrite AutoUpdater source. Avoid overwriting with old code.
-			if (p.path().filename() == "AutoUpdater.cpp" || p.path().filename() == "AutoUpdater.h" || p.path().filename() == "Source.cpp")
+			// Hot reloadable libraries are installed alongside the one in use rather than over it.
+			if (_IsHotReload(p.path()))
 			{
+				int error = _InstallHotReload(p.path(), installPath);
+				if (error != I_SUCCESS)
+					return error;
 				continue;
 			}
-			if (fs::exists(p.path(), ec)) // If file already exists. Overwrite it.
+			if (fs::exists(installPath, ec)) // If file already exists. Overwrite it.
 			{
 				if (p.path().extension() == ".dll") // Checks if file is a dll (if in use, cannot be updated)
 				{
@@ -409,16 +1115,24 @@ int AutoUpdater::installUpdate()
 					if (updateFileSize != installFileSize) // Checks for size difference in files. 
 					{
 						std::cout << "Attempting to overwrite dll file " << path << std::endl;
+						if (m_settings.durableInstall && _BackupInstalledFile(installPath) != I_SUCCESS)
+							return I_FS_RENAME_ERROR;
 						fs::copy(p.path(), installPath, fs::copy_options::overwrite_existing, ec);
 						if (ec.value() != 0)
 						{
 							// Failure to overwrite dll.
 							std::cout << "Failed to overwrite file " << path << std::endl;
 							m_flags.push_back(new Flag(&p.path().string(), ec.message(), I_FS_DLL_ERROR));
+
+							// The old dll was moved aside first. Put it back, or the install would
+							// commit without it and the backup would be cleaned up.
+							if (m_settings.durableInstall && _RestoreBackup(installPath) != I_SUCCESS)
+								return I_FS_DLL_ERROR;
 							continue;
 						}
 
 						std::cout << "Overwrite successful on file " << path << std::endl;
+						m_installedPaths.push_back(installPath.u8string());
 					}
 					else
 					{
@@ -428,13 +1142,17 @@ int AutoUpdater::installUpdate()
 				else // File isn't a dll.
 				{
 					std::cout << "Overwriting File: " << path << std::endl;
+					if (m_settings.durableInstall && _BackupInstalledFile(installPath) != I_SUCCESS)
+						return I_FS_RENAME_ERROR;
 					fs::copy(p.path(), installPath, fs::copy_options::overwrite_existing, ec);
+					m_installedPaths.push_back(installPath.u8string());
 				}
 			}
 			else
 			{
 				std::cout << "Creating File: " << path << std::endl;
 				fs::copy(p.path(), installPath, fs::copy_options::none, ec);
+				m_installedPaths.push_back(installPath.u8string());
 			}
 		}
 
@@ -445,6 +1163,37 @@ int AutoUpdater::installUpdate()
 		}
 	}
 
+	// Make the install durable before the temp directory is removed.
+	// File data and directory entries are flushed first, then a single commit record marks
+	// the install as complete. Only then are the backups and the journal let go.
+	if (m_settings.durableInstall)
+	{
+		if (_FlushInstalledFiles() != I_SUCCESS)
+			return I_FLUSH_ERROR;
+
+		if (_WriteCommitRecord() != I_SUCCESS)
+			return I_COMMIT_ERROR;
+
+		fs::remove(string(m_directory) + "\\" + INSTALL_JOURNAL_NAME, ec);
+		m_pathsToDelete.insert(m_pathsToDelete.end(), m_backupPaths.begin(), m_backupPaths.end());
+		m_backupPaths.clear();
+	}
+	// The record also tells the updater daemon which version is installed.
+	else if (_WriteCommitRecord() != I_SUCCESS)
+		return I_COMMIT_ERROR;
+
+	// Queue files removed upstream for cleanup.
+	if (_UpdateManifest() != CU_SUCCESS)
+		return CU_MANIFEST_ERROR;
+
+	// Keep the artifact as the block reuse seed for the next update. Per-file updates don't have one.
+	if (m_settings.blockReuse && fs::is_regular_file(m_downloadFILE, ec))
+	{
+		string previous = string(m_directory) + "\\" + PREVIOUS_ARTIFACT_NAME;
+		if (!MoveFileExA(m_downloadFILE, previous.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED))
+			std::cout << "Could not keep " << m_downloadNAME << " for block reuse." << std::endl;
+	}
+
 	// Delete update's temp download directory.
 	fs::remove_all(m_downloadDIR, ec);
 	if (ec.value() != 0)
@@ -465,29 +1214,157 @@ int AutoUpdater::cleanup()
 	{
 		m_flags.push_back(new Flag(std::to_string(value), CU_CREATE_PROCESS_ERROR));
 		return CU_CREATE_PROCESS_ERROR;
+	}*/
+
+	_RunPendingCleanup();
+
+	std::cout << std::endl << "Cleanup Successful." << std::endl;
+	return CU_SUCCESS;
+}
+
+void AutoUpdater::_RunPendingCleanup()
+{
+	m_cleanupRan = true;
+
+	// Stale backups and orphans from earlier runs that didn't finish in their budget.
+	string pendingFile(m_directory);
+	pendingFile += "\\";
+	pendingFile += CLEANUP_PENDING_NAME;
+
+	std::ifstream pending(pendingFile);
+	string line;
+	while (std::getline(pending, line))
+	{
+		if (!line.empty() && std::find(m_pathsToDelete.begin(), m_pathsToDelete.end(), line) == m_pathsToDelete.end())
+			m_pathsToDelete.push_back(line);
 	}
+	pending.close();
+	if (m_pathsToDelete.empty())
+		return;
 
-	// Delete files that weren't in update?
-	// Avoid deleting .git
+	// Delete renamed .bak files and orphans within the time budget.
+	uintmax_t reclaimed = 0;
+	_CleanupSlice(m_pathsToDelete, m_settings.cleanupBudgetMs, &reclaimed);
+	_SavePendingCleanup(pendingFile, m_pathsToDelete);
 
-	// Delete renamed .bak files.
-	/*if (!m_pathsToDelete.empty())
+	std::cout << "Reclaimed " << reclaimed / (1024.0 * 1024.0) << " MB. "
+		<< m_pathsToDelete.size() << " files left for later cleanup." << std::endl;
+
+	// Finish the rest in the background, a slice at a time, until the updater is destroyed.
+	// The thread owns its own copy of the work.
+	if (m_settings.backgroundCleanup && !m_pathsToDelete.empty() && !m_cleanupThread.joinable())
 	{
-		std::error_code ec;
-		for (auto iter = m_pathsToDelete.begin(); iter != m_pathsToDelete.end(); iter++)
+		std::vector<string> paths = m_pathsToDelete;
+		unsigned int budget = m_settings.cleanupBudgetMs;
+		m_cleanupThread = std::thread([this, paths, pendingFile, budget]() mutable
 		{
-			fs::remove((*iter), ec);
-			if (ec.value() != 0)
+			// Stops once a slice frees nothing, so files still in use wait for the next start.
+			uintmax_t total = 0;
+			size_t left = paths.size();
+			while (!m_cleanupStop && _CleanupSlice(paths, budget, &total) && paths.size() < left)
 			{
-				m_flags.push_back(new Flag((*iter), ec.message(), CU_FS_REMOVE_ERROR));
+				left = paths.size();
+				_SavePendingCleanup(pendingFile, paths);
+
+				std::unique_lock<std::mutex> lock(m_cleanupMutex);
+				m_cleanupWake.wait_for(lock, std::chrono::milliseconds(CLEANUP_IDLE_MS), [this]() { return m_cleanupStop.load(); });
 			}
+			_SavePendingCleanup(pendingFile, paths);
+
+			std::cout << "Background cleanup reclaimed " << total / (1024.0 * 1024.0) << " MB. "
+				<< paths.size() << " files left for the next start." << std::endl;
+		});
+	}
+}
+
+int AutoUpdater::_UpdateManifest()
+{
+	// Orphans are files listed by the previous update that are not in this one.
+	string manifestFile(m_directory);
+	manifestFile += "\\";
+	manifestFile += MANIFEST_NAME;
+
+	string dir(m_directory);
+	string install = dir.substr(0, dir.find_last_of("/\\"));
+
+	std::vector<string> newFiles = m_updateFiles;
+	std::sort(newFiles.begin(), newFiles.end());
+	newFiles.erase(std::unique(newFiles.begin(), newFiles.end()), newFiles.end());
+
+	std::ifstream oldManifest(manifestFile);
+	string line;
+	while (std::getline(oldManifest, line))
+	{
+		if (!line.empty() && !std::binary_search(newFiles.begin(), newFiles.end(), line))
+		{
+			std::cout << "Orphaned File: " << line << std::endl;
+			m_pathsToDelete.push_back((fs::path(install) / fs::u8path(line)).u8string());
 		}
-	}*/
+	}
+	oldManifest.close();
+
+	std::ofstream manifest(manifestFile, std::ios_base::trunc);
+	if (!manifest.is_open())
+	{
+		m_flags.push_back(new Flag("Could not write manifest: " + manifestFile, CU_MANIFEST_ERROR));
+		return CU_MANIFEST_ERROR;
+	}
+
+	for (auto& file : newFiles)
+		manifest << file << "\n";
 
-	std::cout << std::endl << "Cleanup Successful." << std::endl;
 	return CU_SUCCESS;
 }
 
+bool AutoUpdater::_CleanupSlice(std::vector<string>& paths, unsigned int budget_ms, uintmax_t* reclaimed)
+{
+	// Deletes in batches until the budget runs out. Files that can't be removed yet
+	// (a .bak of the running process, for example) stay queued for a later slice.
+	// Returns true if work is left.
+	auto start = std::chrono::steady_clock::now();
+	auto budget = std::chrono::milliseconds(budget_ms);
+	std::vector<string> retry;
+
+	while (!paths.empty() && std::chrono::steady_clock::now() - start < budget)
+	{
+		for (size_t i = 0; i < CLEANUP_BATCH_SIZE && !paths.empty(); i++)
+		{
+			string path = paths.back();
+			paths.pop_back();
+
+			std::error_code ec;
+			fs::path target = _LongPath(fs::u8path(path));
+			uintmax_t size = fs::file_size(target, ec);
+			if (ec)
+				continue; // Already gone.
+
+			if (fs::remove(target, ec))
+				*reclaimed += size;
+			else
+				retry.push_back(path);
+		}
+	}
+
+	paths.insert(paths.begin(), retry.begin(), retry.end());
+	return !paths.empty();
+}
+
+void AutoUpdater::_SavePendingCleanup(const string& pending_file, const std::vector<string>& paths)
+{
+	if (paths.empty())
+	{
+		std::error_code ec;
+		fs::remove(pending_file, ec);
+		return;
+	}
+
+	// Replaced in one move, so exiting mid-write can't lose the queue.
+	string contents;
+	for (auto& path : paths)
+		contents += path + "\n";
+	_WriteDurableFile(pending_file, contents);
+}
+
 size_t AutoUpdater::_WriteCallback(void *contents, size_t size, size_t nmemb, void *userp)
 {
 	((string*)userp)->append((char*)contents, size * nmemb);
@@ -508,7 +1385,7 @@ void AutoUpdater::_SetDirs(const char* process_location)
 	try
 	{
 		// Get current process's path and set m_exeLOC to it.
-		(process_location == "") ?
+		(process_location == NULL || process_location[0] == '\0') ?
 			GetModuleFileName(NULL, m_exeLOC, sizeof(m_exeLOC)) :
 			strncpy_s(m_exeLOC, process_location, sizeof(m_exeLOC));
 
@@ -551,7 +1428,7 @@ int AutoUpdater::_RenameAndCopy(const char* path)
 	processR += ".bak";
 	fs::rename(process, processR, ec);
 	fs::copy(processR, process, ec);
-	m_pathsToDelete.push_back(processR.string());
+	m_pathsToDelete.push_back(processR.u8string());
 	if (ec.value() != 0)
 	{
 		m_flags.push_back(new Flag(ec.message(), I_FS_REMOVE_ERROR));
@@ -560,6 +1437,434 @@ int AutoUpdater::_RenameAndCopy(const char* path)
 	return I_SUCCESS;
 }
 
+int AutoUpdater::_InstallHotReload(const fs::path& update, const fs::path& installPath)
+{
+	std::error_code ec;
+
+	// Install as <name>.<version>.dll so the library in use is never touched.
+	string name = installPath.stem().string();
+	fs::path versioned = _HotReloadTarget(installPath);
+
+	std::cout << "Installing hot reload library: " << versioned.filename() << std::endl;
+	fs::copy(update, versioned, fs::copy_options::overwrite_existing, ec);
+	if (ec.value() != 0)
+	{
+		m_flags.push_back(new Flag(ec.message(), I_FS_DLL_ERROR));
+		return I_FS_DLL_ERROR;
+	}
+	m_installedPaths.push_back(versioned.u8string());
+
+	// Remember the versioned file so the next start can move it over <name>.dll.
+	// A version installed earlier that never got that far is retired.
+	std::vector<std::pair<string, string>> record = _LoadHotReloadRecord();
+	auto entry = std::find_if(record.begin(), record.end(),
+		[&installPath](const std::pair<string, string>& e) { return e.first == installPath.u8string(); });
+	if (entry == record.end())
+		record.push_back(std::make_pair(installPath.u8string(), versioned.u8string()));
+	else
+	{
+		if (entry->second != versioned.u8string())
+			m_pathsToDelete.push_back(entry->second);
+		entry->second = versioned.u8string();
+	}
+	_SaveHotReloadRecord(record);
+
+	// Swap the running copy over if the library is loaded in the registry.
+	if (m_settings.pluginRegistry != nullptr && m_settings.pluginRegistry->isRegistered(name))
+	{
+		int error = m_settings.pluginRegistry->reload(name, versioned, m_newVersion->getVersionString());
+		if (error != HR_SUCCESS)
+		{
+			m_flags.push_back(new Flag("Hot reload failed for " + name, error));
+			return error;
+		}
+	}
+
+	return I_SUCCESS;
+}
+
+void AutoUpdater::_ActivateHotReload()
+{
+	std::vector<std::pair<string, string>> record = _LoadHotReloadRecord();
+	if (record.empty())
+		return;
+
+	std::vector<std::pair<string, string>> waiting;
+	std::error_code ec;
+	for (auto& entry : record)
+	{
+		fs::path library = fs::u8path(entry.first);
+		fs::path versioned = fs::u8path(entry.second);
+		if (!fs::exists(versioned, ec))
+			continue; // Rolled back or already cleaned up.
+
+		// Fails if something still has <name>.dll loaded, so it is tried again next start.
+		if (MoveFileExW(versioned.wstring().c_str(), library.wstring().c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+			std::cout << "Activated hot reload library: " << library.filename() << std::endl;
+		else
+			waiting.push_back(entry);
+	}
+
+	_SaveHotReloadRecord(waiting);
+}
+
+std::vector<std::pair<string, string>> AutoUpdater::_LoadHotReloadRecord() const
+{
+	// One line per library: <name>.dll path, a tab, then the versioned file that replaces it.
+	std::vector<std::pair<string, string>> record;
+	std::ifstream file(string(m_directory) + "\\" + HOT_RELOAD_RECORD_NAME);
+	string line;
+	while (std::getline(file, line))
+	{
+		size_t tab = line.find('\t');
+		if (tab != string::npos)
+			record.push_back(std::make_pair(line.substr(0, tab), line.substr(tab + 1)));
+	}
+	return record;
+}
+
+void AutoUpdater::_SaveHotReloadRecord(const std::vector<std::pair<string, string>>& record) const
+{
+	string recordPath = string(m_directory) + "\\" + HOT_RELOAD_RECORD_NAME;
+	if (record.empty())
+	{
+		std::error_code ec;
+		fs::remove(recordPath, ec);
+		return;
+	}
+
+	std::ofstream file(recordPath, std::ios_base::trunc);
+	for (auto& entry : record)
+		file << entry.first << "\t" << entry.second << "\n";
+}
+
+int AutoUpdater::_RecoverInstall()
+{
+	string journalPath(m_directory);
+	journalPath += "\\";
+	journalPath += INSTALL_JOURNAL_NAME;
+
+	std::ifstream journal(journalPath);
+	string journalVersion;
+	if (!std::getline(journal, journalVersion))
+		return I_SUCCESS;
+
+	std::vector<std::pair<char, fs::path>> entries;
+	string line;
+	while (std::getline(journal, line))
+	{
+		if (line.size() > 2)
+			entries.push_back(std::make_pair(line[0], fs::u8path(line.substr(2))));
+	}
+	journal.close();
+
+	std::error_code ec;
+
+	// The commit record was written, so only the journal itself was left behind.
+	string committed;
+	if (readCommitRecord(m_directory, &committed) && committed == journalVersion)
+	{
+		for (auto& entry : entries)
+		{
+			fs::path backup = entry.second;
+			backup += ".bak";
+			if (entry.first == 'B' && fs::exists(backup, ec))
+				m_pathsToDelete.push_back(backup.u8string());
+		}
+		fs::remove(journalPath, ec);
+		return I_SUCCESS;
+	}
+
+	// Put every backed up file back and remove files the install created.
+	std::cout << "Rolling back interrupted install of " << journalVersion << "..." << std::endl;
+	for (auto iter = entries.rbegin(); iter != entries.rend(); iter++)
+	{
+		fs::path target = iter->second;
+		fs::path backup = target;
+		backup += ".bak";
+
+		if (iter->first == 'N')
+		{
+			fs::remove(target, ec);
+			continue;
+		}
+
+		if (!fs::exists(backup, ec))
+			continue; // Never backed up, so never overwritten.
+
+		if (!MoveFileExW(backup.wstring().c_str(), target.wstring().c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		{
+			// A running image can't be replaced, but it can be renamed out of the way.
+			fs::path aside = target;
+			aside += ".rollback";
+			if (!MoveFileExW(target.wstring().c_str(), aside.wstring().c_str(), MOVEFILE_REPLACE_EXISTING) ||
+				!MoveFileExW(backup.wstring().c_str(), target.wstring().c_str(), MOVEFILE_WRITE_THROUGH))
+			{
+				m_flags.push_back(new Flag("Could not restore " + target.u8string(), I_FS_RENAME_ERROR));
+				return I_FS_RENAME_ERROR;
+			}
+			m_pathsToDelete.push_back(aside.u8string());
+		}
+	}
+
+	fs::remove(journalPath, ec);
+	std::cout << "Rollback Successful." << std::endl << std::endl;
+	return I_SUCCESS;
+}
+
+int AutoUpdater::_WriteInstallJournal(const fs::path& update, const fs::path& install)
+{
+	// One line per file the install may create (N) or overwrite (B), written and flushed
+	// before anything in the install is changed.
+	string journal = m_newVersion->getVersionString();
+	journal += "\n";
+
+	std::vector<fs::path> targets;
+	targets.push_back(fs::path(m_exeLOC));
+
+	std::error_code ec;
+	for (auto& p : fs::recursive_directory_iterator(update, ec))
+	{
+		if (fs::is_directory(p.path(), ec))
+			continue;
+
+		fs::path target = install / _RelativePath(p.path(), update);
+		targets.push_back(_IsHotReload(p.path()) ? _HotReloadTarget(target) : target);
+	}
+
+	for (auto& target : targets)
+	{
+		if (!fs::exists(target, ec))
+		{
+			journal += "N " + target.u8string() + "\n";
+			continue;
+		}
+
+		// A backup left from an earlier update would be mistaken for one made by this install.
+		fs::path backup = target;
+		backup += ".bak";
+		if (fs::exists(backup, ec) && !fs::remove(backup, ec))
+		{
+			m_flags.push_back(new Flag("Could not remove stale backup " + backup.u8string(), I_FS_REMOVE_ERROR));
+			return I_COMMIT_ERROR;
+		}
+		journal += "B " + target.u8string() + "\n";
+	}
+
+	string journalPath(m_directory);
+	journalPath += "\\";
+	journalPath += INSTALL_JOURNAL_NAME;
+	if (!_WriteDurableFile(journalPath, journal))
+	{
+		m_flags.push_back(new Flag("Could not write install journal: " + journalPath, I_COMMIT_ERROR));
+		return I_COMMIT_ERROR;
+	}
+
+	return I_SUCCESS;
+}
+
+int AutoUpdater::_BackupInstalledFile(const fs::path& target)
+{
+	// Keep the old file as .bak until the commit record is written.
+	// The process is already backed up by _RenameAndCopy.
+	std::error_code ec;
+	fs::path backup = target;
+	backup += ".bak";
+	if (fs::exists(backup, ec))
+		return I_SUCCESS;
+
+	if (!MoveFileExW(target.wstring().c_str(), backup.wstring().c_str(), 0))
+	{
+		m_flags.push_back(new Flag("Could not back up " + target.u8string(), I_FS_RENAME_ERROR));
+		return I_FS_RENAME_ERROR;
+	}
+
+	m_backupPaths.push_back(backup.u8string());
+	return I_SUCCESS;
+}
+
+int AutoUpdater::_RestoreBackup(const fs::path& target)
+{
+	// Only a backup made by this install is moved back. An existing one was kept for a
+	// file this install never touched.
+	fs::path backup = target;
+	backup += ".bak";
+	if (m_backupPaths.empty() || m_backupPaths.back() != backup.u8string())
+		return I_SUCCESS;
+
+	if (!MoveFileExW(backup.wstring().c_str(), target.wstring().c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		m_flags.push_back(new Flag("Could not restore " + target.u8string(), I_FS_RENAME_ERROR));
+		return I_FS_RENAME_ERROR;
+	}
+
+	m_backupPaths.pop_back();
+	return I_SUCCESS;
+}
+
+int AutoUpdater::_FlushInstalledFiles()
+{
+	if (m_installedPaths.empty())
+		return I_SUCCESS;
+
+	// Directories holding installed files and backups are flushed too, so the renames and
+	// new entries are on disk along with the file data.
+	std::vector<std::pair<fs::path, bool>> targets;
+	std::vector<fs::path> directories;
+	for (auto& path : m_installedPaths)
+	{
+		fs::path file = _LongPath(fs::u8path(path));
+		targets.push_back(std::make_pair(file, false));
+		directories.push_back(file.parent_path());
+	}
+	std::sort(directories.begin(), directories.end());
+	directories.erase(std::unique(directories.begin(), directories.end()), directories.end());
+	for (auto& directory : directories)
+		targets.push_back(std::make_pair(directory, true));
+
+	// Flush in batches across worker threads rather than one blocking flush per file.
+	const size_t batchCount = (targets.size() + FLUSH_BATCH_SIZE - 1) / FLUSH_BATCH_SIZE;
+	const size_t threadCount = (std::min)((size_t)(std::max)(1u, std::thread::hardware_concurrency()), batchCount);
+	std::atomic<size_t> nextBatch(0);
+	std::atomic<size_t> failedIndex(targets.size());
+	std::vector<std::thread> workers;
+
+	for (size_t t = 0; t < threadCount; t++)
+	{
+		workers.emplace_back([&targets, batchCount, &nextBatch, &failedIndex]()
+		{
+			size_t batch;
+			while ((batch = nextBatch++) < batchCount)
+			{
+				const size_t end = (std::min)((batch + 1) * FLUSH_BATCH_SIZE, targets.size());
+				for (size_t i = batch * FLUSH_BATCH_SIZE; i < end; i++)
+				{
+					const bool isDirectory = targets[i].second;
+					HANDLE file = CreateFileW(targets[i].first.wstring().c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+						NULL, OPEN_EXISTING, isDirectory ? FILE_FLAG_BACKUP_SEMANTICS : FILE_ATTRIBUTE_NORMAL, NULL);
+					BOOL flushed = (file != INVALID_HANDLE_VALUE) && FlushFileBuffers(file);
+					if (file != INVALID_HANDLE_VALUE)
+						CloseHandle(file);
+
+					// Not every file system can flush a directory handle. NTFS journals the
+					// metadata, and the write-through commit record move flushes that journal.
+					if (!flushed && !isDirectory)
+						failedIndex = i;
+				}
+			}
+		});
+	}
+
+	for (auto& worker : workers)
+		worker.join();
+
+	if (failedIndex < targets.size())
+	{
+		m_flags.push_back(new Flag("Failed to flush " + targets[failedIndex].first.u8string(), I_FLUSH_ERROR));
+		return I_FLUSH_ERROR;
+	}
+
+	std::cout << "Flushed " << m_installedPaths.size() << " installed files and " << directories.size()
+		<< " directories to disk." << std::endl;
+	return I_SUCCESS;
+}
+
+int AutoUpdater::_WriteCommitRecord()
+{
+	// The record only exists once every file is on disk.
+	string recordPath(m_directory);
+	recordPath += "\\";
+	recordPath += COMMIT_RECORD_NAME;
+
+	string record = m_newVersion->getVersionString();
+	record += "\n";
+	record += std::to_string(m_installedPaths.size());
+	record += "\n";
+
+	if (!_WriteDurableFile(recordPath, record))
+	{
+		m_flags.push_back(new Flag("Could not write commit record: " + recordPath, I_COMMIT_ERROR));
+		return I_COMMIT_ERROR;
+	}
+
+	return I_SUCCESS;
+}
+
+bool AutoUpdater::readCommitRecord(const string& directory, string* version)
+{
+	std::ifstream record(directory + "\\" + COMMIT_RECORD_NAME);
+	string committed;
+	if (!std::getline(record, committed) || committed.empty())
+		return false;
+
+	if (version != NULL)
+		*version = committed;
+	return true;
+}
+
+bool AutoUpdater::_WriteDurableFile(const string& path, const string& contents)
+{
+	// Write to a temp file, flush it, then move it into place with write-through.
+	// The move is the single point where the new contents appear.
+	string tempPath = path + ".tmp";
+
+	HANDLE file = CreateFileA(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	DWORD written = 0;
+	BOOL ok = WriteFile(file, contents.c_str(), (DWORD)contents.size(), &written, NULL) && written == contents.size();
+	ok = ok && FlushFileBuffers(file);
+	CloseHandle(file);
+
+	return ok && MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+}
+
+fs::path AutoUpdater::_RelativePath(const fs::path& path, const fs::path& base)
+{
+	std::wstring relative = path.wstring().substr(base.wstring().size());
+	relative.erase(0, relative.find_first_not_of(L"/\\"));
+	return fs::path(relative);
+}
+
+bool AutoUpdater::_IsHotReload(const fs::path& file) const
+{
+	return file.extension() == ".dll" && std::find(m_settings.hotReloadLibraries.begin(),
+		m_settings.hotReloadLibraries.end(), file.filename().string()) != m_settings.hotReloadLibraries.end();
+}
+
+fs::path AutoUpdater::_HotReloadTarget(const fs::path& install_path) const
+{
+	return install_path.parent_path() / (install_path.stem().string() + "." + m_newVersion->getVersionString() + install_path.extension().string());
+}
+
+fs::path AutoUpdater::_LongPath(const fs::path& path)
+{
+	// The extended-length prefix lifts the MAX_PATH limit. It is only valid on absolute
+	// paths with backslash separators, so relative paths are left alone.
+	std::wstring wide = fs::path(path).make_preferred().wstring();
+	if (wide.compare(0, 4, L"\\\\?\\") == 0 || !path.has_root_name() || !path.has_root_directory())
+		return fs::path(wide);
+
+	if (wide.compare(0, 2, L"\\\\") == 0)
+		return fs::path(L"\\\\?\\UNC\\" + wide.substr(2));
+	return fs::path(L"\\\\?\\" + wide);
+}
+
+fs::path AutoUpdater::_ZipEntryPath(const char* name, bool utf8)
+{
+	// Convert with the entry's own code page rather than the process's.
+	const UINT codePage = utf8 ? CP_UTF8 : 437;
+	int length = MultiByteToWideChar(codePage, 0, name, -1, NULL, 0);
+	if (length <= 0)
+		return fs::path(name);
+
+	std::wstring wide(length, L'\0');
+	MultiByteToWideChar(codePage, 0, name, -1, &wide[0], length);
+	wide.resize(length - 1);
+	return fs::path(wide);
+}
+
 void AutoUpdater::_OutFlags()
 {
 	if (m_flags.empty())
@@ -582,6 +1887,8 @@ void AutoUpdater::_OutFlags()
 		}
 	}
 	// TODO: System pause is windows specific.
-	system("pause");
+	// Staging runs unattended, so there is nobody to press a key.
+	if (!m_settings.stageOnly)
+		system("pause");
 }
 
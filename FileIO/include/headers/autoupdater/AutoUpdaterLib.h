@@ -4,8 +4,12 @@
 #include <vector>
 #include <iostream>
 
+#include <atomic>
+#include <condition_variable>
 #include <exception>
 #include <experimental/filesystem>
+#include <mutex>
+#include <thread>
 
 #define MAX_FILENAME 255
 #define MAX_PATH 260
@@ -24,6 +28,7 @@
 #define UPDATER_CURL_ERROR			(3)
 #define UPDATER_INVALID_INPUT		(4)
 #define UPDATER_DIRECTORY_EXCEPTION	(5)
+#define UPDATER_LOCK_ERROR			(6)
 
 // 0 Version Number Errors. - Handles version number type and downloadVersionNumber() function.
 #define VN_SUCCESS					(UPDATER_SUCCESS)
@@ -41,6 +46,13 @@
 #define DU_ERROR_WRITE_TO_FILE		(21)
 #define DU_CURL_ERROR				(41)
 #define DU_FWRITE_ERROR				(51)
+#define DU_MIRROR_ERROR				(61)
+#define DU_BLOCK_FILE_ERROR			(71)
+#define DU_BLOCK_RANGE_ERROR		(81)
+#define DU_BLOCK_VERIFY_ERROR		(91)
+#define DU_MANIFEST_ERROR			(101)
+#define DU_FETCH_ERROR				(111)
+#define DU_HASH_ERROR				(121)
 
 // 2 Unzipping Errors. - Handles unZip() function
 #define UZ_SUCCESS					(UPDATER_SUCCESS)
@@ -52,6 +64,9 @@
 #define UZ_CANNOT_OPEN_DEST_FILE	(82)
 #define UZ_READ_FILE_ERROR			(92)
 #define UZ_CANNOT_READ_NEXT_FILE	(102)
+#define UZ_INFLATE_ERROR			(112)
+#define UZ_CRC_ERROR				(122)
+#define UZ_UNSAFE_PATH_ERROR		(132)
 
 // 3 Installing Update Errors. - Handles installUpdate() function
 #define I_SUCCESS					(UPDATER_SUCCESS)
@@ -61,16 +76,166 @@
 #define I_FS_DLL_ERROR				(53)
 #define I_FS_COPY_ERROR				(33)
 #define I_FS_REMOVE_ERROR			(43)
+#define I_FLUSH_ERROR				(63)
+#define I_COMMIT_ERROR				(73)
 
 // 4 Cleanup Errors. - Handles cleanup() function
 #define CU_SUCCESS					(UPDATER_SUCCESS)
 #define CU_FS_REMOVE_ERROR			(14)
 #define CU_CREATE_PROCESS_ERROR		(24)
+#define CU_MANIFEST_ERROR			(34)
+
+// 5 Hot Reload Errors. - Handles PluginRegistry
+#define HR_SUCCESS					(UPDATER_SUCCESS)
+#define HR_LOAD_ERROR				(15)
+#define HR_SYMBOL_ERROR				(25)
+#define HR_NOT_REGISTERED			(35)
+
+// Durable Install.
+#define COMMIT_RECORD_NAME			"update.commit"
+#define INSTALL_JOURNAL_NAME		"update.journal"
+#define FLUSH_BATCH_SIZE			64
+
+// Cleanup.
+#define MANIFEST_NAME				"update.manifest"
+#define CLEANUP_PENDING_NAME		"cleanup.pending"
+#define CLEANUP_BATCH_SIZE			32
+#define CLEANUP_BUDGET_MS			200
+#define CLEANUP_IDLE_MS				1000
+
+// Mirrors.
+#define MIRROR_SCORES_NAME			"mirrors.dat"
+#define MIRROR_RACE_COUNT			3
+#define MIRROR_RACE_STAGGER_MS		250
+#define MIRROR_PROBE_TIMEOUT_MS		5000
+#define MIRROR_FAIL_PENALTY			(60000.0)
+#define MIRROR_SCORE_WEIGHT			(0.3)
+#define MIRROR_LOW_SPEED_LIMIT		(16 * 1024)
+#define MIRROR_LOW_SPEED_TIME		10
+#define ARTIFACT_HASH_PREFIX		"sha256 "
+
+// Block Reuse.
+#define PREVIOUS_ARTIFACT_NAME		"previous.zip"
+
+// Hot Reload.
+#define HOT_RELOAD_RECORD_NAME		"hotreload.pending"
+
+// Staged Updates.
+#define STAGED_MARKER_NAME			"staged.update"
+#define TEMP_LOCK_NAME				"update.lock"
+#define TEMP_LOCK_TIMEOUT_MS		30000
+#define TEMP_LOCK_RETRY_MS			50
+
+// Per-File Fetch.
+#define FETCH_MAX_STREAMS			16
+
+// Whole-Entry Inflate. - UPDATER_USE_LIBDEFLATE (set by building with /p:UseLibdeflate=true) inflates small entries with libdeflate.
+#define INFLATE_BUDGET				(64ull * 1024 * 1024)
+
+// Pipelined Inflate.
+#define PIPELINE_THRESHOLD			(256ull * 1024 * 1024)
+#define PIPELINE_BUFFERS			8
+#define PIPELINE_BUFFER_SIZE		(1024 * 1024)
 
 namespace fs = std::experimental::filesystem;
 using std::string;
 using std::exception;
 
+class PluginRegistry;
+
+// Optional behaviour for the updater. Defaults match the original updater.
+struct UpdaterSettings
+{
+public:
+	// Upper bound of a random delay before checking for an update. Spreads a fleet's
+	// checks out after a release instead of every instance hitting the server at once.
+	unsigned int checkJitterMs = 0;
+
+	// Download and extract an available update without prompting or installing it.
+	// Used by the updater daemon to prepare the next version ahead of time.
+	bool stageOnly = false;
+
+	// Install an update previously prepared with stageOnly, without touching the network.
+	bool activateStaged = false;
+
+	// Flush installed files to disk and write a commit record once the install is complete.
+	// Overwritten files are kept as .bak until then, and an install interrupted before the
+	// commit record is written is rolled back from them on the next start.
+	bool durableInstall = false;
+
+	// Time cleanup() may spend deleting per call. Work left over is saved and picked up
+	// on the next start, or by a background thread between updates if enabled. The thread
+	// stops after its current slice when the updater is destroyed or stopCleanup() is called.
+	unsigned int cleanupBudgetMs = CLEANUP_BUDGET_MS;
+	bool backgroundCleanup = false;
+
+	// Glob rules applied to archive entries before they are extracted, relative to the
+	// archive's root folder. Excluded entries are never decompressed or installed.
+	// The default excludes avoid overwriting the AutoUpdater source with old code.
+	std::vector<string> includeRules;
+	std::vector<string> excludeRules = { "AutoUpdater.cpp", "AutoUpdater.h", "Source.cpp" };
+
+	// Largest uncompressed entry inflated in one call. Larger entries are streamed.
+	unsigned long long inflateBudget = INFLATE_BUDGET;
+
+	// Entries at least this large are inflated and written on separate threads.
+	unsigned long long pipelineThreshold = PIPELINE_THRESHOLD;
+
+	// Number of mirrors probed at once, and the bytes/second a download must hold
+	// for the given number of seconds before failing over to the next mirror.
+	int mirrorRaceCount = MIRROR_RACE_COUNT;
+	long mirrorLowSpeedLimit = MIRROR_LOW_SPEED_LIMIT;
+	long mirrorLowSpeedTime = MIRROR_LOW_SPEED_TIME;
+
+	// Build the update from blocks of the previous artifact and the install, fetching only
+	// missing ranges. Needs a block file published next to the download URL.
+	bool blockReuse = false;
+
+	// Fetch only changed files listed in a per-file manifest instead of the whole zip,
+	// with up to fetchMaxStreams requests multiplexed over one HTTP/2 connection.
+	string fileManifestURL;
+	int fetchMaxStreams = FETCH_MAX_STREAMS;
+
+	// Library file names (e.g. "plugin.dll") installed under a versioned name instead of
+	// being overwritten. Libraries loaded in the registry are hot reloaded after install.
+	// The versioned file replaces <name>.dll on the next start, before anything loads it.
+	std::vector<string> hotReloadLibraries;
+	PluginRegistry *pluginRegistry = nullptr;
+};
+
+// A download mirror listed in the version file.
+// Mirrors are only used when the version file also publishes the artifact's hash
+// on a "sha256 <hex>" line, and every mirror download is checked against it.
+struct Mirror
+{
+public:
+	Mirror(const string a_url, double a_score = 0.0)
+		: url(a_url), score(a_score)
+	{
+
+	}
+
+	string url;
+	double score; // Smoothed probe latency in milliseconds. 0 if never probed.
+};
+
+// Exclusive lock on the temp directory, shared between the application and the updater daemon.
+// Held as an open lock file in the process directory, so it is released if the holder exits.
+struct TempDirLock
+{
+public:
+	TempDirLock(const string& directory, unsigned int timeout_ms);
+	~TempDirLock();
+
+	inline bool isLocked() const { return m_handle != NULL; }
+
+private:
+	TempDirLock(const TempDirLock&) = delete;
+	TempDirLock& operator=(const TempDirLock&) = delete;
+
+	void *m_handle;
+};
+
 struct Flag
 {
 public:
@@ -252,7 +417,8 @@ private:
 class AutoUpdater
 	{
 	public:
-		AutoUpdater(Version cur_version, const string version_url, const string download_url, const char* process_location = "");
+		AutoUpdater(Version cur_version, const string version_url, const string download_url, const char* process_location = "",
+			UpdaterSettings settings = UpdaterSettings());
 		~AutoUpdater();
 
 		int run();
@@ -263,20 +429,73 @@ class AutoUpdater
 		int unZipUpdate();
 		int installUpdate();
 		int cleanup();
+		void stopCleanup();
+
+		static bool readStagedMarker(const string& download_dir, string* version, fs::path* extracted_dir, std::vector<string>* files);
+		static bool readCommitRecord(const string& directory, string* version);
+		static string processDirectory(const char* process_location = "");
+		static string downloadDirectory(const char* process_location = "");
+
+		inline const char* getDownloadDIR() const { return m_downloadDIR; }
+		inline const std::vector<Flag*>& getFlags() const { return m_flags; }
 
 	private:
+		int _Update();
+		int _RunStaged();
+		int _WriteStagedMarker();
 		static size_t _WriteCallback(void *contents, size_t size, size_t nmemb, void *userp);
 		static size_t _WriteData(void *ptr, size_t size, size_t nmemb, FILE *stream);
 		void _SetDirs(const char* process_location = "");
 		int _RenameAndCopy(const char* path);
+		int _UpdateManifest();
+		void _RunPendingCleanup();
+		static bool _CleanupSlice(std::vector<string>& paths, unsigned int budget_ms, uintmax_t* reclaimed);
+		static void _SavePendingCleanup(const string& pending_file, const std::vector<string>& paths);
+		int _RecoverInstall();
+		int _WriteInstallJournal(const fs::path& update, const fs::path& install);
+		int _BackupInstalledFile(const fs::path& target);
+		int _RestoreBackup(const fs::path& target);
+		int _FlushInstalledFiles();
+		int _WriteCommitRecord();
+		static bool _WriteDurableFile(const string& path, const string& contents);
+		static fs::path _RelativePath(const fs::path& path, const fs::path& base);
+		bool _IsHotReload(const fs::path& file) const;
+		fs::path _HotReloadTarget(const fs::path& install_path) const;
+		static fs::path _LongPath(const fs::path& path);
+		static fs::path _ZipEntryPath(const char* name, bool utf8);
+		int _DownloadFromMirrors();
+		void _RaceMirrors();
+		void _LoadMirrorScores();
+		void _SaveMirrorScores();
+		int _VerifyArtifact();
+		int _DownloadWithBlockReuse();
+		int _DownloadPerFile();
+		int _InstallHotReload(const fs::path& update, const fs::path& installPath);
+		void _ActivateHotReload();
+		std::vector<std::pair<string, string>> _LoadHotReloadRecord() const;
+		void _SaveHotReloadRecord(const std::vector<std::pair<string, string>>& record) const;
 		void _OutFlags();
 
 	protected:
 		Version * m_version;
 		Version *m_newVersion;
+		UpdaterSettings m_settings;
+		bool m_filesFetched = false;
+		bool m_cleanupRan = false;
+
+		std::thread m_cleanupThread;
+		std::atomic<bool> m_cleanupStop;
+		std::mutex m_cleanupMutex;
+		std::condition_variable m_cleanupWake;
 
+		// Paths held as strings are UTF-8.
 		std::vector<string> m_pathsToDelete;
+		std::vector<string> m_installedPaths;
+		std::vector<string> m_backupPaths;
+		std::vector<string> m_updateFiles;
 		std::vector<Flag*>	m_flags;
+		std::vector<Mirror> m_mirrors;
+		string m_artifactHash; // Lower case hex SHA-256 from the version file. Empty if not published.
 
 		char m_versionURL[MAX_URL];
 		char m_downloadURL[MAX_URL];
@@ -285,7 +504,7 @@ class AutoUpdater
 		char m_downloadDIR[MAX_PATH];
 		char m_downloadNAME[MAX_FILENAME];
 		char m_downloadFILE[MAX_PATH + MAX_FILENAME];
-		char m_extractedDIR[MAX_PATH];
+		fs::path m_extractedDIR;
 		char m_exeLOC[MAX_PATH + MAX_FILENAME];
 	};
 
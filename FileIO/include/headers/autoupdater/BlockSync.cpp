@@ -0,0 +1,223 @@
+#include "BlockSync.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+BlockSync::BlockSync()
+	: m_blockSize(BLOCK_SIZE), m_fileSize(0), m_foundCount(0)
+{
+	memset(m_fileHash, 0, sizeof(m_fileHash));
+}
+
+BlockSync::~BlockSync()
+{
+
+}
+
+int BlockSync::writeBlockFile(const fs::path& artifact, const fs::path& block_file, uint32_t block_size)
+{
+	MappedFile file(artifact);
+	if (file.data() == NULL || block_size == 0)
+		return DU_BLOCK_FILE_ERROR;
+
+	std::ofstream out(block_file, std::ios_base::binary | std::ios_base::trunc);
+	if (!out.is_open())
+		return DU_BLOCK_FILE_ERROR;
+
+	Sha256 fileHash;
+	unsigned char hash[SHA256_SIZE];
+	if (!fileHash.update(file.data(), file.size()) || !fileHash.finish(hash))
+		return DU_BLOCK_FILE_ERROR;
+
+	uint64_t fileSize = file.size();
+	out.write(BLOCK_FILE_MAGIC, 4);
+	out.write((const char*)&block_size, sizeof(block_size));
+	out.write((const char*)&fileSize, sizeof(fileSize));
+	out.write((const char*)hash, sizeof(hash));
+
+	// The last block is zero padded so every block hashes the same length.
+	std::vector<unsigned char> padded(block_size);
+	for (uint64_t offset = 0; offset < fileSize; offset += block_size)
+	{
+		const unsigned char *block = file.data() + offset;
+		if (offset + block_size > fileSize)
+		{
+			std::fill(padded.begin(), padded.end(), 0);
+			memcpy(padded.data(), block, (size_t)(fileSize - offset));
+			block = padded.data();
+		}
+
+		BlockChecksum checksum;
+		uint32_t a, b;
+		_WeakHash(block, block_size, &a, &b);
+		checksum.weak = a | (b << 16);
+		if (!_StrongHash(block, block_size, checksum.strong))
+			return DU_BLOCK_FILE_ERROR;
+
+		out.write((const char*)&checksum, sizeof(checksum));
+	}
+
+	return out.good() ? DU_SUCCESS : DU_BLOCK_FILE_ERROR;
+}
+
+int BlockSync::parseBlockFile(const string& contents)
+{
+	const size_t headerSize = 4 + sizeof(m_blockSize) + sizeof(m_fileSize) + sizeof(m_fileHash);
+	if (contents.size() < headerSize || contents.compare(0, 4, BLOCK_FILE_MAGIC) != 0)
+		return DU_BLOCK_FILE_ERROR;
+
+	const char *p = contents.data() + 4;
+	memcpy(&m_blockSize, p, sizeof(m_blockSize));
+	p += sizeof(m_blockSize);
+	memcpy(&m_fileSize, p, sizeof(m_fileSize));
+	p += sizeof(m_fileSize);
+	memcpy(m_fileHash, p, sizeof(m_fileHash));
+	p += sizeof(m_fileHash);
+
+	if (m_blockSize == 0)
+		return DU_BLOCK_FILE_ERROR;
+
+	const size_t count = (size_t)((m_fileSize + m_blockSize - 1) / m_blockSize);
+	if (contents.size() != headerSize + count * sizeof(BlockChecksum))
+		return DU_BLOCK_FILE_ERROR;
+
+	m_blocks.resize(count);
+	memcpy(m_blocks.data(), p, count * sizeof(BlockChecksum));
+	m_found.assign(count, false);
+	m_foundCount = 0;
+
+	m_lookup.clear();
+	m_lookup.reserve(count);
+	for (size_t i = 0; i < count; i++)
+		m_lookup.emplace(m_blocks[i].weak, i);
+
+	return DU_SUCCESS;
+}
+
+int BlockSync::scanSeed(const fs::path& seed, FILE* out)
+{
+	if (isComplete())
+		return DU_SUCCESS;
+
+	MappedFile file(seed);
+	const unsigned char *data = file.data();
+	const size_t size = file.size();
+	const size_t blockSize = m_blockSize;
+	if (data == NULL || size < blockSize)
+		return DU_SUCCESS;
+
+	uint32_t a, b;
+	_WeakHash(data, blockSize, &a, &b);
+
+	size_t i = 0;
+	while (i + blockSize <= size)
+	{
+		bool matched = false;
+		auto range = m_lookup.equal_range(a | (b << 16));
+		if (range.first != range.second)
+		{
+			// Only compute the strong hash once the weak hash has a candidate.
+			unsigned char strong[BLOCK_STRONG_SIZE];
+			if (!_StrongHash(data + i, blockSize, strong))
+				return DU_BLOCK_FILE_ERROR;
+
+			for (auto iter = range.first; iter != range.second; iter++)
+			{
+				size_t index = iter->second;
+				if (m_found[index] || memcmp(m_blocks[index].strong, strong, BLOCK_STRONG_SIZE) != 0)
+					continue;
+
+				// Copy the block into place. The final block may be shorter than the block size.
+				uint64_t offset = (uint64_t)index * blockSize;
+				size_t length = (size_t)(std::min)((uint64_t)blockSize, m_fileSize - offset);
+				if (_fseeki64(out, (long long)offset, SEEK_SET) != 0 || fwrite(data + i, length, 1, out) != 1)
+					return DU_FWRITE_ERROR;
+
+				m_found[index] = true;
+				m_foundCount++;
+				matched = true;
+			}
+		}
+
+		if (isComplete())
+			break;
+
+		if (matched)
+		{
+			// Skip past the matched block and restart the rolling sum.
+			i += blockSize;
+			if (i + blockSize <= size)
+				_WeakHash(data + i, blockSize, &a, &b);
+			continue;
+		}
+
+		// Roll the window forward by one byte.
+		if (i + blockSize < size)
+		{
+			a = (a - data[i] + data[i + blockSize]) & 0xffff;
+			b = (b - (uint32_t)(blockSize * data[i]) + a) & 0xffff;
+		}
+		i++;
+	}
+
+	return DU_SUCCESS;
+}
+
+int BlockSync::verify(const fs::path& artifact) const
+{
+	MappedFile file(artifact);
+	if (file.data() == NULL || file.size() != m_fileSize)
+		return DU_BLOCK_VERIFY_ERROR;
+
+	Sha256 fileHash;
+	unsigned char hash[SHA256_SIZE];
+	if (!fileHash.update(file.data(), file.size()) || !fileHash.finish(hash))
+		return DU_BLOCK_VERIFY_ERROR;
+
+	return memcmp(hash, m_fileHash, SHA256_SIZE) == 0 ? DU_SUCCESS : DU_BLOCK_VERIFY_ERROR;
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> BlockSync::getMissingRanges() const
+{
+	// Neighbouring missing blocks are merged into a single inclusive byte range.
+	std::vector<std::pair<uint64_t, uint64_t>> ranges;
+	for (size_t i = 0; i < m_blocks.size(); i++)
+	{
+		if (m_found[i])
+			continue;
+
+		uint64_t start = (uint64_t)i * m_blockSize;
+		uint64_t end = (std::min)(start + m_blockSize, m_fileSize) - 1;
+		if (!ranges.empty() && ranges.back().second + 1 == start)
+			ranges.back().second = end;
+		else
+			ranges.push_back(std::make_pair(start, end));
+	}
+	return ranges;
+}
+
+void BlockSync::_WeakHash(const unsigned char* data, size_t size, uint32_t* a, uint32_t* b)
+{
+	// rsync rolling checksum. a is the byte sum, b the weighted sum, both mod 2^16.
+	uint32_t sumA = 0;
+	uint32_t sumB = 0;
+	for (size_t i = 0; i < size; i++)
+	{
+		sumA += data[i];
+		sumB += (uint32_t)(size - i) * data[i];
+	}
+	*a = sumA & 0xffff;
+	*b = sumB & 0xffff;
+}
+
+bool BlockSync::_StrongHash(const unsigned char* data, size_t size, unsigned char strong[BLOCK_STRONG_SIZE])
+{
+	Sha256 blockHash;
+	unsigned char hash[SHA256_SIZE];
+	if (!blockHash.update(data, size) || !blockHash.finish(hash))
+		return false;
+
+	memcpy(strong, hash, BLOCK_STRONG_SIZE);
+	return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "AutoUpdaterLib.h"
+#include "FileHash.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+
+#define BLOCK_FILE_MAGIC		"ZSBK"
+#define BLOCK_FILE_EXTENSION	".blocks"
+#define BLOCK_SIZE				4096
+#define BLOCK_STRONG_SIZE		8
+
+// Checksums for one block of the published artifact.
+struct BlockChecksum
+{
+public:
+	uint32_t weak;
+	unsigned char strong[BLOCK_STRONG_SIZE];
+};
+
+// zsync-style block reuse.
+// The release side publishes a block file holding a rolling weak hash and a truncated
+// SHA-256 for every block of the artifact. The client finds blocks it already has in
+// local files with a rolling checksum, and only needs the remaining byte ranges.
+//
+// Block file layout: magic, uint32 block size, uint64 file size, SHA-256 of the whole
+// artifact, then one BlockChecksum per block. The last block is zero padded.
+class BlockSync
+{
+public:
+	BlockSync();
+	~BlockSync();
+
+	// Release side. Writes the block file for an artifact.
+	static int writeBlockFile(const fs::path& artifact, const fs::path& block_file, uint32_t block_size = BLOCK_SIZE);
+
+	// Client side.
+	int parseBlockFile(const string& contents);
+	int scanSeed(const fs::path& seed, FILE* out);
+	int verify(const fs::path& artifact) const;
+	std::vector<std::pair<uint64_t, uint64_t>> getMissingRanges() const;
+
+	inline uint32_t getBlockSize() const { return m_blockSize; }
+	inline uint64_t getFileSize() const { return m_fileSize; }
+	inline size_t getBlockCount() const { return m_blocks.size(); }
+	inline size_t getFoundCount() const { return m_foundCount; }
+	inline bool isComplete() const { return m_foundCount == m_blocks.size(); }
+
+private:
+	static void _WeakHash(const unsigned char* data, size_t size, uint32_t* a, uint32_t* b);
+	static bool _StrongHash(const unsigned char* data, size_t size, unsigned char strong[BLOCK_STRONG_SIZE]);
+
+	uint32_t m_blockSize;
+	uint64_t m_fileSize;
+	unsigned char m_fileHash[SHA256_SIZE];
+
+	std::vector<BlockChecksum> m_blocks;
+	std::vector<bool> m_found;
+	size_t m_foundCount;
+	std::unordered_multimap<uint32_t, size_t> m_lookup;
+};
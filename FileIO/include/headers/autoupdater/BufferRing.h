@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define RING_SPIN_COUNT		64
+#define RING_PARK_MS		100
+
+// A single-producer single-consumer ring of preallocated buffers.
+// The producer fills the buffer from acquireWrite() and publishes it with commitWrite().
+// The consumer takes it with acquireRead() and hands it back with commitRead().
+// Both return NULL instead of blocking. wait() spins briefly and then parks the calling
+// thread until the other side commits, so a stalled stage doesn't burn a core.
+class BufferRing
+{
+public:
+	struct Buffer
+	{
+		std::vector<char> data;
+		size_t size = 0;
+	};
+
+	BufferRing(size_t count, size_t buffer_size)
+		: m_buffers(count), m_head(0), m_tail(0), m_waiters(0)
+	{
+		for (auto& buffer : m_buffers)
+			buffer.data.resize(buffer_size);
+	}
+
+	// Producer side.
+	inline Buffer* acquireWrite()
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head - m_tail.load(std::memory_order_acquire) == m_buffers.size())
+			return NULL; // Full.
+		return &m_buffers[head % m_buffers.size()];
+	}
+	inline void commitWrite()
+	{
+		m_head.fetch_add(1, std::memory_order_release);
+		_Notify();
+	}
+
+	// Consumer side.
+	inline Buffer* acquireRead()
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail == m_head.load(std::memory_order_acquire))
+			return NULL; // Empty.
+		return &m_buffers[tail % m_buffers.size()];
+	}
+	inline void commitRead()
+	{
+		m_tail.fetch_add(1, std::memory_order_release);
+		_Notify();
+	}
+
+	// Blocks until ready() returns true. The lock-free path is tried first; the
+	// timeout only bounds the wait if a signal outside the ring is set without wake().
+	template <typename Ready>
+	void wait(Ready ready)
+	{
+		for (int i = 0; i < RING_SPIN_COUNT; i++)
+		{
+			if (ready())
+				return;
+			std::this_thread::yield();
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_waiters.fetch_add(1, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		while (!ready())
+			m_wake.wait_for(lock, std::chrono::milliseconds(RING_PARK_MS));
+		m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+	}
+
+	// Wakes a parked thread after a flag it waits on (done, failed) is set.
+	inline void wake()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_wake.notify_all();
+	}
+
+private:
+	inline void _Notify()
+	{
+		// Only take the lock when someone is parked, so the hot path stays lock-free.
+		// The fence pairs with the waiter registering before it re-checks ready().
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_waiters.load(std::memory_order_relaxed) == 0)
+			return;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_wake.notify_all();
+	}
+
+	std::vector<Buffer> m_buffers;
+
+	// Kept on separate cache lines so the two threads don't contend.
+	alignas(64) std::atomic<size_t> m_head;
+	alignas(64) std::atomic<size_t> m_tail;
+
+	std::atomic<int> m_waiters;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+};
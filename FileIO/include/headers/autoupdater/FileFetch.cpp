@@ -0,0 +1,319 @@
+#include "FileFetch.h"
+#include "zlib\zlib.h"
+
+#include <curl/curl.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+// State for one file being downloaded.
+struct FileFetch::Transfer
+{
+	CURL *curl = nullptr;
+	FILE *out = nullptr;
+	z_stream stream;
+	bool streamEnded = false;
+	bool failed = false;
+	Sha256 hash;
+	const FileEntry *entry = nullptr;
+};
+
+FileFetch::FileFetch()
+{
+
+}
+
+FileFetch::~FileFetch()
+{
+
+}
+
+int FileFetch::writeManifest(const fs::path& source_dir, const fs::path& out_dir)
+{
+	std::error_code ec;
+	fs::create_directories(out_dir, ec);
+	if (!fs::is_directory(source_dir, ec) || !fs::is_directory(out_dir, ec))
+		return DU_MANIFEST_ERROR;
+
+	string manifest;
+	const size_t sourcePrefix = source_dir.u8string().size();
+	for (auto iter = fs::recursive_directory_iterator(source_dir, ec); iter != fs::recursive_directory_iterator(); iter.increment(ec))
+	{
+		if (ec)
+			return DU_MANIFEST_ERROR;
+
+		// Don't publish the output directory if it sits inside the source.
+		if (fs::is_directory(iter->path(), ec))
+		{
+			if (fs::equivalent(iter->path(), out_dir, ec))
+				iter.disable_recursion_pending();
+			continue;
+		}
+
+		MappedFile file(iter->path());
+		Sha256 hash;
+		unsigned char digest[SHA256_SIZE];
+		if ((file.size() > 0 && (file.data() == NULL || !hash.update(file.data(), file.size()))) || !hash.finish(digest))
+			return DU_MANIFEST_ERROR;
+		string hex = Sha256::toHex(digest);
+
+		// Files with the same contents share one object.
+		fs::path object = out_dir / (hex + FILE_OBJECT_EXTENSION);
+		if (!fs::exists(object, ec))
+		{
+			gzFile out = gzopen_w(object.wstring().c_str(), "wb9");
+			if (out == NULL)
+				return DU_FWRITE_ERROR;
+
+			// gzwrite takes an unsigned length, so large files go in chunks.
+			size_t offset = 0;
+			while (offset < file.size())
+			{
+				unsigned chunk = (unsigned)(std::min)(file.size() - offset, (size_t)INT_MAX);
+				if (gzwrite(out, file.data() + offset, chunk) != (int)chunk)
+				{
+					gzclose(out);
+					fs::remove(object, ec);
+					return DU_FWRITE_ERROR;
+				}
+				offset += chunk;
+			}
+			if (gzclose(out) != Z_OK)
+			{
+				fs::remove(object, ec);
+				return DU_FWRITE_ERROR;
+			}
+		}
+
+		// Manifest paths are UTF-8 and '/' separated, relative to the source directory.
+		string path = iter->path().u8string().substr(sourcePrefix);
+		std::replace(path.begin(), path.end(), '\\', '/');
+		path.erase(0, path.find_first_not_of('/'));
+		manifest += hex + " " + std::to_string(file.size()) + " " + path + "\n";
+	}
+
+	// Written last, so a manifest only lists objects that exist.
+	std::ofstream out(out_dir / FILE_MANIFEST_NAME, std::ios_base::binary | std::ios_base::trunc);
+	out << manifest;
+	out.close();
+	return out.fail() ? DU_FWRITE_ERROR : DU_SUCCESS;
+}
+
+int FileFetch::parseManifest(const string& contents)
+{
+	m_entries.clear();
+	m_changed.clear();
+
+	std::istringstream lines(contents);
+	string line;
+	while (std::getline(lines, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (line.empty())
+			continue;
+
+		// The path is the rest of the line, so it may contain spaces.
+		std::istringstream fields(line);
+		FileEntry entry;
+		if (!(fields >> entry.hash >> entry.size))
+			return DU_MANIFEST_ERROR;
+		fields.get();
+		std::getline(fields, entry.path);
+
+		if (entry.hash.size() != SHA256_SIZE * 2 || !PathFilter::isSafePath(entry.path))
+			return DU_MANIFEST_ERROR;
+
+		m_entries.push_back(entry);
+	}
+
+	return m_entries.empty() ? DU_MANIFEST_ERROR : DU_SUCCESS;
+}
+
+void FileFetch::applyFilter(const PathFilter& filter)
+{
+	// Excluded files are dropped before anything points into the entry list.
+	m_changed.clear();
+	m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(),
+		[&filter](const FileEntry& entry) { return !filter.accepts(entry.path, false); }), m_entries.end());
+}
+
+size_t FileFetch::selectChanged(const fs::path& install_dir)
+{
+	m_changed.clear();
+	for (auto& entry : m_entries)
+	{
+		// Size is checked first so most changed files are found without hashing.
+		fs::path local = install_dir / fs::u8path(entry.path);
+		std::error_code ec;
+		uintmax_t size = fs::file_size(local, ec);
+		if (ec || size != entry.size)
+		{
+			m_changed.push_back(&entry);
+			continue;
+		}
+
+		MappedFile file(local);
+		Sha256 hash;
+		unsigned char digest[SHA256_SIZE];
+		if (size > 0 && (file.data() == NULL || !hash.update(file.data(), file.size())))
+		{
+			m_changed.push_back(&entry);
+			continue;
+		}
+
+		if (!hash.finish(digest) || Sha256::toHex(digest) != entry.hash)
+			m_changed.push_back(&entry);
+	}
+	return m_changed.size();
+}
+
+int FileFetch::fetch(const string& base_url, const fs::path& staging_dir, int max_streams)
+{
+	if (m_changed.empty())
+		return DU_SUCCESS;
+
+	CURLM *multi = curl_multi_init();
+	if (!multi)
+		return DU_CURL_ERROR;
+
+	// One connection, with a bounded number of streams multiplexed over it.
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, 1L);
+	curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)max_streams);
+
+	std::vector<std::unique_ptr<Transfer>> transfers;
+	size_t next = 0;
+	int active = 0;
+	int error = DU_SUCCESS;
+
+	while ((next < m_changed.size() && error == DU_SUCCESS) || active > 0)
+	{
+		// Keep the stream window full.
+		while (active < max_streams && next < m_changed.size() && error == DU_SUCCESS)
+		{
+			const FileEntry *entry = m_changed[next++];
+			std::unique_ptr<Transfer> transfer(new Transfer());
+			transfer->entry = entry;
+
+			// Manifest paths use forward slashes, which extended-length paths don't accept.
+			fs::path target = staging_dir / fs::u8path(entry->path);
+			target.make_preferred();
+			std::error_code ec;
+			fs::create_directories(target.parent_path(), ec);
+			_wfopen_s(&transfer->out, target.wstring().c_str(), L"wb");
+
+			memset(&transfer->stream, 0, sizeof(transfer->stream));
+			if (transfer->out == NULL || inflateInit2(&transfer->stream, 15 + 32) != Z_OK) // Accept gzip or zlib headers.
+			{
+				if (transfer->out != NULL)
+					fclose(transfer->out);
+				error = DU_FWRITE_ERROR;
+				break;
+			}
+
+			string url = base_url + entry->hash + FILE_OBJECT_EXTENSION;
+			transfer->curl = curl_easy_init();
+			curl_easy_setopt(transfer->curl, CURLOPT_URL, url.c_str());
+			curl_easy_setopt(transfer->curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+			curl_easy_setopt(transfer->curl, CURLOPT_PIPEWAIT, 1L);
+			curl_easy_setopt(transfer->curl, CURLOPT_FOLLOWLOCATION, 1L);
+			curl_easy_setopt(transfer->curl, CURLOPT_NOSIGNAL, 1);
+			curl_easy_setopt(transfer->curl, CURLOPT_WRITEFUNCTION, _WriteCallback);
+			curl_easy_setopt(transfer->curl, CURLOPT_WRITEDATA, transfer.get());
+			curl_easy_setopt(transfer->curl, CURLOPT_PRIVATE, transfer.get());
+			curl_multi_add_handle(multi, transfer->curl);
+
+			transfers.push_back(std::move(transfer));
+			active++;
+		}
+
+		int running = 0;
+		curl_multi_perform(multi, &running);
+
+		int queued = 0;
+		CURLMsg *msg;
+		while ((msg = curl_multi_info_read(multi, &queued)) != NULL)
+		{
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			Transfer *transfer = nullptr;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &transfer);
+			long status = 0;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &status);
+
+			inflateEnd(&transfer->stream);
+			fclose(transfer->out);
+			transfer->out = NULL;
+
+			// The file is only accepted if it inflated completely and matches the manifest hash.
+			unsigned char digest[SHA256_SIZE];
+			if (msg->data.result != CURLE_OK || status != 200 || transfer->failed || !transfer->streamEnded)
+			{
+				std::cout << "Failed to fetch " << transfer->entry->path << std::endl;
+				error = DU_FETCH_ERROR;
+			}
+			else if (!transfer->hash.finish(digest) || Sha256::toHex(digest) != transfer->entry->hash)
+			{
+				std::cout << "Hash mismatch on " << transfer->entry->path << std::endl;
+				error = DU_HASH_ERROR;
+			}
+			else
+			{
+				std::cout << "Fetched File: " << transfer->entry->path << std::endl;
+			}
+
+			curl_multi_remove_handle(multi, msg->easy_handle);
+			curl_easy_cleanup(msg->easy_handle);
+			transfer->curl = nullptr;
+			active--;
+		}
+
+		if (active > 0)
+			curl_multi_poll(multi, NULL, 0, 1000, NULL);
+	}
+
+	curl_multi_cleanup(multi);
+	return error;
+}
+
+size_t FileFetch::_WriteCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+	Transfer *transfer = (Transfer*)userp;
+	const size_t length = size * nmemb;
+
+	// Inflate as data arrives and write each piece straight to disk.
+	unsigned char buffer[READ_SIZE];
+	transfer->stream.next_in = (Bytef*)contents;
+	transfer->stream.avail_in = (uInt)length;
+	do
+	{
+		transfer->stream.next_out = buffer;
+		transfer->stream.avail_out = sizeof(buffer);
+
+		int result = inflate(&transfer->stream, Z_NO_FLUSH);
+		if (result == Z_BUF_ERROR)
+			break; // Needs more input.
+
+		if (result != Z_OK && result != Z_STREAM_END)
+		{
+			transfer->failed = true;
+			return 0;
+		}
+
+		size_t produced = sizeof(buffer) - transfer->stream.avail_out;
+		if (produced > 0 && (fwrite(buffer, produced, 1, transfer->out) != 1 || !transfer->hash.update(buffer, produced)))
+		{
+			transfer->failed = true;
+			return 0;
+		}
+
+		transfer->streamEnded = (result == Z_STREAM_END);
+	} while (!transfer->streamEnded && (transfer->stream.avail_in > 0 || transfer->stream.avail_out == 0));
+
+	return length;
+}
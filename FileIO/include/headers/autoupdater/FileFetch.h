@@ -0,0 +1,51 @@
+#pragma once
+
+#include "AutoUpdaterLib.h"
+#include "FileHash.h"
+#include "PathFilter.h"
+
+#include <cstdint>
+
+#define FILE_OBJECT_EXTENSION	".gz"
+#define FILE_MANIFEST_NAME		"files.manifest"
+
+// A file listed in a per-file update manifest.
+struct FileEntry
+{
+public:
+	string hash;	// Lower case hex SHA-256 of the uncompressed file.
+	uint64_t size;
+	string path;	// Relative to the install directory, '/' separated.
+};
+
+// Per-file updates.
+// The release side publishes a manifest with one "<sha256> <size> <path>" line per file,
+// and each file gzip compressed as <hash>.gz next to it. The client only requests the
+// files whose hashes differ from the installed ones, multiplexed over one HTTP/2
+// connection, and writes each file out as it arrives.
+class FileFetch
+{
+public:
+	FileFetch();
+	~FileFetch();
+
+	// Release side. Writes the manifest and one <hash>.gz object per distinct file under out_dir.
+	static int writeManifest(const fs::path& source_dir, const fs::path& out_dir);
+
+	// Client side.
+	int parseManifest(const string& contents);
+	void applyFilter(const PathFilter& filter);
+	size_t selectChanged(const fs::path& install_dir);
+	int fetch(const string& base_url, const fs::path& staging_dir, int max_streams = FETCH_MAX_STREAMS);
+
+	inline const std::vector<FileEntry>& getEntries() const { return m_entries; }
+	inline const std::vector<const FileEntry*>& getChanged() const { return m_changed; }
+
+private:
+	struct Transfer;
+
+	static size_t _WriteCallback(void *contents, size_t size, size_t nmemb, void *userp);
+
+	std::vector<FileEntry> m_entries;
+	std::vector<const FileEntry*> m_changed;
+};
@@ -0,0 +1,94 @@
+#include "FileHash.h"
+
+#include <windows.h>
+#include <bcrypt.h>
+#include <algorithm>
+
+#pragma comment(lib, "bcrypt.lib")
+
+// The provider is opened once, since opening it is far more expensive than hashing a block.
+static BCRYPT_ALG_HANDLE _OpenSha256Provider()
+{
+	BCRYPT_ALG_HANDLE alg = NULL;
+	if (BCryptOpenAlgorithmProvider(&alg, BCRYPT_SHA256_ALGORITHM, NULL, 0) != 0)
+		return NULL;
+	return alg;
+}
+
+Sha256::Sha256()
+	: m_hash(NULL)
+{
+	static BCRYPT_ALG_HANDLE alg = _OpenSha256Provider();
+	BCRYPT_HASH_HANDLE hash = NULL;
+	if (alg != NULL && BCryptCreateHash(alg, &hash, NULL, 0, NULL, 0, 0) == 0)
+		m_hash = hash;
+}
+
+Sha256::~Sha256()
+{
+	if (m_hash != NULL)
+		BCryptDestroyHash((BCRYPT_HASH_HANDLE)m_hash);
+}
+
+bool Sha256::update(const void* data, size_t size)
+{
+	// BCryptHashData takes a 32-bit length, so large inputs are hashed in pieces.
+	const unsigned char *p = (const unsigned char*)data;
+	while (size > 0)
+	{
+		ULONG chunk = (ULONG)(std::min)(size, (size_t)0x40000000);
+		if (m_hash == NULL || BCryptHashData((BCRYPT_HASH_HANDLE)m_hash, (PUCHAR)p, chunk, 0) != 0)
+			return false;
+		p += chunk;
+		size -= chunk;
+	}
+	return m_hash != NULL;
+}
+
+bool Sha256::finish(unsigned char hash[SHA256_SIZE])
+{
+	return m_hash != NULL && BCryptFinishHash((BCRYPT_HASH_HANDLE)m_hash, hash, SHA256_SIZE, 0) == 0;
+}
+
+string Sha256::toHex(const unsigned char hash[SHA256_SIZE])
+{
+	static const char digits[] = "0123456789abcdef";
+	string hex(SHA256_SIZE * 2, '0');
+	for (size_t i = 0; i < SHA256_SIZE; i++)
+	{
+		hex[i * 2] = digits[hash[i] >> 4];
+		hex[i * 2 + 1] = digits[hash[i] & 0xf];
+	}
+	return hex;
+}
+
+MappedFile::MappedFile(const fs::path& path)
+	: m_file(INVALID_HANDLE_VALUE), m_mapping(NULL), m_view(NULL), m_size(0)
+{
+	m_file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE)
+		return;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+		return;
+
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping == NULL)
+		return;
+
+	m_view = (const unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (m_view != NULL)
+		m_size = (size_t)size.QuadPart;
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_view != NULL)
+		UnmapViewOfFile(m_view);
+	if (m_mapping != NULL)
+		CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "AutoUpdaterLib.h"
+
+#define SHA256_SIZE 32
+
+// Incremental SHA-256 through the Windows CNG provider.
+class Sha256
+{
+public:
+	Sha256();
+	~Sha256();
+
+	bool update(const void* data, size_t size);
+	bool finish(unsigned char hash[SHA256_SIZE]);
+
+	static string toHex(const unsigned char hash[SHA256_SIZE]);
+
+private:
+	void *m_hash;
+};
+
+// Read-only mapping of a whole file. Empty or missing files map to NULL.
+class MappedFile
+{
+public:
+	MappedFile(const fs::path& path);
+	~MappedFile();
+
+	inline const unsigned char* data() const { return m_view; }
+	inline size_t size() const { return m_size; }
+
+private:
+	void *m_file;
+	void *m_mapping;
+	const unsigned char *m_view;
+	size_t m_size;
+};
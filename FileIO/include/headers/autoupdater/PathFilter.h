@@ -0,0 +1,62 @@
+#pragma once
+
+#include "AutoUpdaterLib.h"
+
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+// A set of glob patterns compiled once for fast matching.
+// Patterns without a '/' match any single path segment, e.g. "*.md" or ".git".
+// Patterns with a '/' match the whole path, where "**" spans any number of segments.
+// The common shapes are sorted into hash lookups and a prefix trie so most paths
+// never reach the general glob matcher.
+class GlobSet
+{
+public:
+	GlobSet();
+	~GlobSet();
+
+	void add(const string& pattern);
+	bool matches(const std::vector<string>& segments) const;
+	inline bool empty() const { return m_empty; }
+
+private:
+	struct TrieNode
+	{
+		bool terminal = false;
+		std::unordered_map<string, std::unique_ptr<TrieNode>> children;
+	};
+
+	static bool _HasWildcard(const string& text);
+	static bool _MatchSegment(const char* pattern, const char* text);
+	static bool _MatchPath(const std::vector<string>& pattern, size_t p, const std::vector<string>& path, size_t s);
+
+	bool m_empty;
+	std::unordered_set<string> m_names;			// "Source.cpp", ".git"
+	std::unordered_set<string> m_extensions;	// "*.md" stored as ".md"
+	std::vector<string> m_segmentGlobs;			// "*_linux*"
+	TrieNode m_prefixes;						// "docs/**", "bin/linux/**"
+	std::vector<std::vector<string>> m_pathGlobs;	// "src/*/test/*.cpp"
+};
+
+// Include/exclude rules for archive entries.
+// A path is accepted if it matches no exclude rule and, when include rules are given,
+// matches at least one of them. Include rules only apply to files, so directories
+// are still created for the files that are kept.
+class PathFilter
+{
+public:
+	PathFilter(const std::vector<string>& include_rules, const std::vector<string>& exclude_rules);
+	~PathFilter();
+
+	bool accepts(const string& path, bool is_directory) const;
+
+	static bool isSafePath(const string& path);
+
+private:
+	static std::vector<string> _Split(const string& path);
+
+	GlobSet m_include;
+	GlobSet m_exclude;
+};
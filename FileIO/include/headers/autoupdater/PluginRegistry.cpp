@@ -0,0 +1,99 @@
+#include "PluginRegistry.h"
+
+#include <windows.h>
+
+PluginModule::~PluginModule()
+{
+	if (m_handle != NULL)
+		FreeLibrary((HMODULE)m_handle);
+}
+
+PluginRegistry::PluginRegistry()
+{
+
+}
+
+PluginRegistry::~PluginRegistry()
+{
+
+}
+
+int PluginRegistry::load(const string& name, const fs::path& library, const std::vector<string>& symbols, const string version)
+{
+	std::shared_ptr<const PluginModule> module;
+	int error = _LoadModule(library, symbols, version, &module);
+	if (error != HR_SUCCESS)
+		return error;
+
+	auto slot = std::make_shared<Slot>();
+	slot->symbols = symbols;
+	slot->module = module;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_slots[name] = slot;
+	return HR_SUCCESS;
+}
+
+int PluginRegistry::reload(const string& name, const fs::path& library, const string version)
+{
+	std::shared_ptr<Slot> slot;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_slots.find(name);
+		if (iter == m_slots.end())
+			return HR_NOT_REGISTERED;
+		slot = iter->second;
+	}
+
+	// The new library is fully resolved before it is published, so a failed
+	// reload leaves the old version in place.
+	std::shared_ptr<const PluginModule> module;
+	int error = _LoadModule(library, slot->symbols, version, &module);
+	if (error != HR_SUCCESS)
+		return error;
+
+	// Callers holding the old module keep it alive until they release it.
+	std::atomic_store(&slot->module, module);
+	std::cout << "Hot reloaded " << name << " from " << library.string() << std::endl;
+	return HR_SUCCESS;
+}
+
+std::shared_ptr<const PluginModule> PluginRegistry::acquire(const string& name) const
+{
+	std::shared_ptr<Slot> slot;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_slots.find(name);
+		if (iter == m_slots.end())
+			return nullptr;
+		slot = iter->second;
+	}
+	return std::atomic_load(&slot->module);
+}
+
+bool PluginRegistry::isRegistered(const string& name) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_slots.find(name) != m_slots.end();
+}
+
+int PluginRegistry::_LoadModule(const fs::path& library, const std::vector<string>& symbols, const string& version, std::shared_ptr<const PluginModule>* module)
+{
+	HMODULE handle = LoadLibraryW(library.wstring().c_str());
+	if (handle == NULL)
+		return HR_LOAD_ERROR;
+
+	// The module owns the handle from here, so any early return frees the library.
+	auto loaded = std::make_shared<PluginModule>(handle, version);
+	for (auto& symbol : symbols)
+	{
+		FARPROC function = GetProcAddress(handle, symbol.c_str());
+		if (function == NULL)
+			return HR_SYMBOL_ERROR;
+
+		loaded->m_functions[symbol] = (void*)function;
+	}
+
+	*module = loaded;
+	return HR_SUCCESS;
+}
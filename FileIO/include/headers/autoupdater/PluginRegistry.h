@@ -0,0 +1,63 @@
+#pragma once
+
+#include "AutoUpdaterLib.h"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// A loaded version of a plugin library and the functions resolved from it.
+// The library is freed when the last reference to the module is released.
+struct PluginModule
+{
+public:
+	PluginModule(void* handle, const string version)
+		: m_handle(handle), m_version(version)
+	{
+
+	}
+	~PluginModule();
+
+	template <typename T>
+	inline T getFunction(const string& name) const
+	{
+		auto iter = m_functions.find(name);
+		return (iter != m_functions.end()) ? reinterpret_cast<T>(iter->second) : nullptr;
+	}
+	inline const string& getVersion() const { return m_version; }
+
+private:
+	friend class PluginRegistry;
+
+	void *m_handle;
+	string m_version;
+	std::unordered_map<string, void*> m_functions;
+};
+
+// Hot reload of plugin-style libraries.
+// Callers acquire() a module and hold it for the duration of a call. reload() loads the
+// new library, resolves its function table and swaps it in atomically. The old library
+// is retired once every caller holding it has let go.
+class PluginRegistry
+{
+public:
+	PluginRegistry();
+	~PluginRegistry();
+
+	int load(const string& name, const fs::path& library, const std::vector<string>& symbols, const string version = "");
+	int reload(const string& name, const fs::path& library, const string version = "");
+	std::shared_ptr<const PluginModule> acquire(const string& name) const;
+	bool isRegistered(const string& name) const;
+
+private:
+	struct Slot
+	{
+		std::vector<string> symbols;
+		std::shared_ptr<const PluginModule> module;
+	};
+
+	int _LoadModule(const fs::path& library, const std::vector<string>& symbols, const string& version, std::shared_ptr<const PluginModule>* module);
+
+	mutable std::mutex m_mutex;
+	std::unordered_map<string, std::shared_ptr<Slot>> m_slots;
+};
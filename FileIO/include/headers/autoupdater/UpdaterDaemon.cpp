@@ -0,0 +1,136 @@
+#include "UpdaterDaemon.h"
+
+#include <windows.h>
+#include <chrono>
+#include <random>
+
+UpdaterDaemon::UpdaterDaemon(Version cur_version, const string version_url, const string download_url, const char* process_location,
+	UpdaterSettings settings, const string name)
+	: m_version(new Version(cur_version)), m_versionURL(version_url), m_downloadURL(download_url), m_processLocation(process_location),
+	m_settings(settings), m_pipeName(DAEMON_PIPE_PREFIX + name), m_processDIR(AutoUpdater::processDirectory(process_location)),
+	m_downloadDIR(AutoUpdater::downloadDirectory(process_location)), m_running(false)
+{
+	// The daemon does its own scheduling and staging runs unattended.
+	m_settings.checkJitterMs = 0;
+	m_settings.stageOnly = true;
+	m_settings.activateStaged = false;
+}
+
+UpdaterDaemon::~UpdaterDaemon()
+{
+	stop();
+}
+
+void UpdaterDaemon::run()
+{
+	m_running = true;
+	m_pipeThread = std::thread(&UpdaterDaemon::_ServePipe, this);
+
+	// The first check runs as soon as the machine is idle.
+	std::random_device seed;
+	std::uniform_int_distribution<unsigned int> jitter(0, DAEMON_CHECK_JITTER_MS);
+	auto nextCheck = std::chrono::steady_clock::now();
+
+	while (m_running)
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+
+		// Checks are due on the schedule, but only run once the user has gone idle.
+		if (std::chrono::steady_clock::now() < nextCheck || _IdleMs() < DAEMON_IDLE_MS)
+			continue;
+
+		_Stage();
+		nextCheck = std::chrono::steady_clock::now() + std::chrono::milliseconds(DAEMON_CHECK_INTERVAL_MS + jitter(seed));
+	}
+}
+
+void UpdaterDaemon::stop()
+{
+	if (!m_running.exchange(false))
+		return;
+
+	// Connect once to release the pipe thread from ConnectNamedPipe.
+	char reply[DAEMON_MESSAGE_SIZE];
+	DWORD read = 0;
+	CallNamedPipeA(m_pipeName.c_str(), (LPVOID)"STOP", 4, reply, sizeof(reply), &read, DAEMON_QUERY_TIMEOUT_MS);
+
+	if (m_pipeThread.joinable())
+		m_pipeThread.join();
+}
+
+int UpdaterDaemon::queryPending(const string name, string* version)
+{
+	// A single short call. If the daemon isn't running the app carries on without it.
+	string pipeName = DAEMON_PIPE_PREFIX + name;
+	char reply[DAEMON_MESSAGE_SIZE] = "\0";
+	DWORD read = 0;
+	if (!CallNamedPipeA(pipeName.c_str(), (LPVOID)"STATUS", 6, reply, sizeof(reply) - 1, &read, DAEMON_QUERY_TIMEOUT_MS))
+		return DAEMON_UNAVAILABLE;
+
+	string response(reply, read);
+	if (response.compare(0, 6, "READY ") != 0)
+		return DAEMON_NO_UPDATE;
+
+	if (version != NULL)
+		*version = response.substr(6);
+	return DAEMON_UPDATE_READY;
+}
+
+void UpdaterDaemon::_Stage()
+{
+	// The app may have installed an update since the daemon started, so the installed
+	// version is read back from the commit record rather than the one passed in.
+	string committed;
+	if (AutoUpdater::readCommitRecord(m_processDIR, &committed))
+	{
+		std::unique_ptr<Version> installed(new Version(committed));
+		if (installed->getError() == VN_SUCCESS)
+			m_version = std::move(installed);
+	}
+
+	// AutoUpdater runs on construction. With stageOnly it downloads and extracts without installing.
+	AutoUpdater *updater = new AutoUpdater(*m_version, m_versionURL, m_downloadURL, m_processLocation.c_str(), m_settings);
+	delete updater;
+}
+
+void UpdaterDaemon::_ServePipe()
+{
+	while (m_running)
+	{
+		HANDLE pipe = CreateNamedPipeA(m_pipeName.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT,
+			PIPE_UNLIMITED_INSTANCES, DAEMON_MESSAGE_SIZE, DAEMON_MESSAGE_SIZE, 0, NULL);
+		if (pipe == INVALID_HANDLE_VALUE)
+			return;
+
+		if (ConnectNamedPipe(pipe, NULL) || GetLastError() == ERROR_PIPE_CONNECTED)
+		{
+			char request[DAEMON_MESSAGE_SIZE];
+			DWORD read = 0;
+			if (ReadFile(pipe, request, sizeof(request), &read, NULL))
+			{
+				// The staged marker is only written once an update is fully extracted.
+				string version;
+				string response = "NONE";
+				if (AutoUpdater::readStagedMarker(m_downloadDIR, &version, NULL, NULL))
+					response = "READY " + version;
+
+				DWORD written = 0;
+				WriteFile(pipe, response.c_str(), (DWORD)response.size(), &written, NULL);
+				FlushFileBuffers(pipe);
+			}
+		}
+
+		DisconnectNamedPipe(pipe);
+		CloseHandle(pipe);
+	}
+}
+
+unsigned int UpdaterDaemon::_IdleMs()
+{
+	LASTINPUTINFO info;
+	info.cbSize = sizeof(info);
+	if (!GetLastInputInfo(&info))
+		return 0;
+
+	return GetTickCount() - info.dwTime;
+}
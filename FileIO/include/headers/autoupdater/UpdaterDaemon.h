@@ -0,0 +1,55 @@
+#pragma once
+
+#include "AutoUpdaterLib.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#define DAEMON_PIPE_PREFIX			"\\\\.\\pipe\\AutoUpdater-"
+#define DAEMON_CHECK_INTERVAL_MS	(60 * 60 * 1000)
+#define DAEMON_CHECK_JITTER_MS		(10 * 60 * 1000)
+#define DAEMON_IDLE_MS				(2 * 60 * 1000)
+#define DAEMON_QUERY_TIMEOUT_MS		50
+#define DAEMON_MESSAGE_SIZE			1024
+
+// Result of asking the daemon whether an update is ready.
+#define DAEMON_NO_UPDATE			(0)
+#define DAEMON_UPDATE_READY			(1)
+#define DAEMON_UNAVAILABLE			(-1)
+
+// Long-lived updater service.
+// Checks for updates on a jittered schedule and, while the machine is idle, downloads
+// and extracts the next version into staging. The app asks over a named pipe at startup
+// and either gets "nothing pending" or activates the prepared update, so launches never
+// wait on the network.
+class UpdaterDaemon
+{
+public:
+	UpdaterDaemon(Version cur_version, const string version_url, const string download_url, const char* process_location = "",
+		UpdaterSettings settings = UpdaterSettings(), const string name = "default");
+	~UpdaterDaemon();
+
+	void run();
+	void stop();
+
+	// Client side. Returns DAEMON_UPDATE_READY, DAEMON_NO_UPDATE or DAEMON_UNAVAILABLE.
+	static int queryPending(const string name = "default", string* version = NULL);
+
+private:
+	void _Stage();
+	void _ServePipe();
+	static unsigned int _IdleMs();
+
+	std::unique_ptr<Version> m_version; // Refreshed from the commit record before each check.
+	string m_versionURL;
+	string m_downloadURL;
+	string m_processLocation;
+	UpdaterSettings m_settings;
+
+	string m_pipeName;
+	string m_processDIR;
+	string m_downloadDIR;
+	std::atomic<bool> m_running;
+	std::thread m_pipeThread;
+};
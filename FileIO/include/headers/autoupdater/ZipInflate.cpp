@@ -0,0 +1,138 @@
+#include "ZipInflate.h"
+#include "BufferRing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <thread>
+#include <vector>
+
+int inflateStreamed(unzFile zipfile, FILE *out)
+{
+	if (unzOpenCurrentFile(zipfile) != UNZ_OK)
+		return UZ_FILE_INFO_ERROR;
+
+	// Buffer to hold data read from the zip file.
+	char read_buffer[READ_SIZE];
+
+	int error = UNZ_OK;
+	do
+	{
+		error = unzReadCurrentFile(zipfile, read_buffer, READ_SIZE);
+		if (error < 0)
+			return UZ_READ_FILE_ERROR;
+
+		// Write data to file.
+		if (error > 0)
+		{
+			if (fwrite(read_buffer, error, 1, out) != 1)
+				return UZ_FWRITE_ERROR;
+		}
+	} while (error > 0);
+
+	// minizip only compares the CRC once the entry is closed after a full read.
+	if (unzCloseCurrentFile(zipfile) == UNZ_CRCERROR)
+		return UZ_CRC_ERROR;
+
+	return UZ_SUCCESS;
+}
+
+int inflatePipelined(unzFile zipfile, FILE *out)
+{
+	if (unzOpenCurrentFile(zipfile) != UNZ_OK)
+		return UZ_FILE_INFO_ERROR;
+
+	// This thread inflates into the ring while a writer thread drains it to disk.
+	// A full ring stalls the inflater, so the entry runs at the pace of the slower stage.
+	BufferRing ring(PIPELINE_BUFFERS, PIPELINE_BUFFER_SIZE);
+	std::atomic<bool> inflateDone(false);
+	std::atomic<bool> writeFailed(false);
+
+	std::thread writer([&ring, &inflateDone, &writeFailed, out]()
+	{
+		while (true)
+		{
+			BufferRing::Buffer *buffer = NULL;
+			ring.wait([&]() { return (buffer = ring.acquireRead()) != NULL || inflateDone.load(std::memory_order_acquire); });
+			if (buffer == NULL)
+			{
+				// Check for more data after seeing the done flag, so nothing committed just before it is missed.
+				buffer = ring.acquireRead();
+				if (buffer == NULL)
+					return;
+			}
+
+			if (!writeFailed && fwrite(buffer->data.data(), buffer->size, 1, out) != 1)
+				writeFailed = true;
+			ring.commitRead();
+		}
+	});
+
+	int error = UZ_SUCCESS;
+	while (error == UZ_SUCCESS && !writeFailed)
+	{
+		BufferRing::Buffer *buffer = NULL;
+		ring.wait([&]() { return (buffer = ring.acquireWrite()) != NULL || writeFailed.load(); });
+		if (buffer == NULL)
+			break;
+
+		int read = unzReadCurrentFile(zipfile, buffer->data.data(), (unsigned)buffer->data.size());
+		if (read < 0)
+			error = UZ_READ_FILE_ERROR;
+		if (read <= 0)
+			break;
+
+		buffer->size = read;
+		ring.commitWrite();
+	}
+
+	inflateDone.store(true, std::memory_order_release);
+	ring.wake();
+	writer.join();
+
+	if (error == UZ_SUCCESS && writeFailed)
+		error = UZ_FWRITE_ERROR;
+
+	// minizip only compares the CRC once the entry is closed after a full read.
+	if (error == UZ_SUCCESS && unzCloseCurrentFile(zipfile) == UNZ_CRCERROR)
+		error = UZ_CRC_ERROR;
+	return error;
+}
+
+#ifdef UPDATER_USE_LIBDEFLATE
+int inflateWhole(unzFile zipfile, const unz_file_info64 &file_info, FILE *out, libdeflate_decompressor *decompressor)
+{
+	// Open in raw mode so minizip hands back the deflate stream untouched.
+	int method = 0;
+	int level = 0;
+	if (unzOpenCurrentFile2(zipfile, &method, &level, 1) != UNZ_OK)
+		return UZ_FILE_INFO_ERROR;
+
+	std::vector<char> compressed((size_t)file_info.compressed_size);
+	size_t offset = 0;
+	while (offset < compressed.size())
+	{
+		unsigned chunk = (unsigned)(std::min)(compressed.size() - offset, (size_t)INT_MAX);
+		int read = unzReadCurrentFile(zipfile, compressed.data() + offset, chunk);
+		if (read <= 0)
+			return UZ_READ_FILE_ERROR;
+		offset += read;
+	}
+
+	// Inflate the whole entry at once and verify it against the central directory CRC.
+	std::vector<char> inflated((size_t)file_info.uncompressed_size);
+	size_t actual = 0;
+	if (libdeflate_deflate_decompress(decompressor, compressed.data(), compressed.size(),
+		inflated.data(), inflated.size(), &actual) != LIBDEFLATE_SUCCESS || actual != inflated.size())
+		return UZ_INFLATE_ERROR;
+
+	if (libdeflate_crc32(0, inflated.data(), inflated.size()) != file_info.crc)
+		return UZ_CRC_ERROR;
+
+	// Write data to file.
+	if (!inflated.empty() && fwrite(inflated.data(), inflated.size(), 1, out) != 1)
+		return UZ_FWRITE_ERROR;
+
+	return UZ_SUCCESS;
+}
+#endif
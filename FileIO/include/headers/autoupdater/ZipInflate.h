@@ -0,0 +1,28 @@
+#pragma once
+
+#include "AutoUpdaterLib.h"
+#include "zlib\unzip.h"
+
+#ifdef UPDATER_USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include <cstdio>
+
+// Ways of inflating the current entry of a zip into an open file.
+// unZipUpdate picks one per entry, and the inflate benchmark compares them.
+
+// The streamed and pipelined paths close the entry once it is read and return UZ_CRC_ERROR
+// if minizip reports a CRC mismatch.
+
+// Inflates through zlib a READ_SIZE chunk at a time.
+int inflateStreamed(unzFile zipfile, FILE *out);
+
+// Inflates on this thread while a second thread writes, through a ring of PIPELINE_BUFFERS buffers.
+int inflatePipelined(unzFile zipfile, FILE *out);
+
+#ifdef UPDATER_USE_LIBDEFLATE
+// Inflates a deflated entry in one libdeflate call and checks its CRC.
+// The whole entry is held in memory, so callers keep this to entries within their budget.
+int inflateWhole(unzFile zipfile, const unz_file_info64 &file_info, FILE *out, libdeflate_decompressor *decompressor);
+#endif
@@ -0,0 +1,156 @@
+#include "ZipInflate.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Compares the inflate paths unZipUpdate chooses between, over every entry of each archive.
+// Output goes to the NUL device so only inflate cost is measured, unless --out names a file.
+//
+// Usage: InflateBenchmark [--runs N] [--out file] archive.zip [archive.zip ...]
+
+using std::cout;
+using std::endl;
+using std::string;
+
+typedef std::function<int(unzFile, const unz_file_info64&, FILE*)> InflateMode;
+
+struct Mode
+{
+public:
+	const char *name;
+	InflateMode inflate;
+};
+
+// Inflates every entry of the archive with one mode and returns the best time in seconds,
+// or a negative value if the archive could not be inflated.
+static double timeArchive(const string& archive, const string& output, int runs, const InflateMode& inflate, ZPOS64_T* bytes)
+{
+	double best = -1.0;
+	for (int run = 0; run < runs; run++)
+	{
+		unzFile zipfile = unzOpen64(archive.c_str());
+		if (zipfile == NULL)
+			return -1.0;
+
+		unz_global_info64 global_info;
+		FILE *out = NULL;
+		fopen_s(&out, output.c_str(), "wb");
+		if (out == NULL || unzGetGlobalInfo64(zipfile, &global_info) != UNZ_OK)
+		{
+			if (out != NULL)
+				fclose(out);
+			unzClose(zipfile);
+			return -1.0;
+		}
+
+		bool failed = false;
+		*bytes = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (ZPOS64_T i = 0; i < global_info.number_entry && !failed; i++)
+		{
+			unz_file_info64 file_info;
+			if (unzGetCurrentFileInfo64(zipfile, &file_info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK)
+			{
+				failed = true;
+				break;
+			}
+
+			// Directory entries are empty.
+			if (file_info.uncompressed_size > 0)
+			{
+				failed = inflate(zipfile, file_info, out) != UZ_SUCCESS;
+				*bytes += file_info.uncompressed_size;
+			}
+			unzCloseCurrentFile(zipfile);
+
+			if ((i + 1) < global_info.number_entry && unzGoToNextFile(zipfile) != UNZ_OK)
+				break;
+		}
+		fflush(out);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		fclose(out);
+		unzClose(zipfile);
+		if (failed)
+			return -1.0;
+		if (best < 0.0 || seconds < best)
+			best = seconds;
+	}
+	return best;
+}
+
+int main(int argc, char* argv[])
+{
+	int runs = 3;
+	string output = "NUL";
+	std::vector<string> archives;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg(argv[i]);
+		if (arg == "--runs" && i + 1 < argc)
+			runs = (std::max)(1, atoi(argv[++i]));
+		else if (arg == "--out" && i + 1 < argc)
+			output = argv[++i];
+		else
+			archives.push_back(arg);
+	}
+
+	if (archives.empty())
+	{
+		std::cerr << "Usage: InflateBenchmark [--runs N] [--out file] archive.zip [archive.zip ...]" << endl;
+		return 1;
+	}
+
+	std::vector<Mode> modes;
+	modes.push_back({ "streamed", [](unzFile zipfile, const unz_file_info64&, FILE *out) { return inflateStreamed(zipfile, out); } });
+	modes.push_back({ "pipelined", [](unzFile zipfile, const unz_file_info64&, FILE *out) { return inflatePipelined(zipfile, out); } });
+
+#ifdef UPDATER_USE_LIBDEFLATE
+	// Same choice unZipUpdate makes. Entries libdeflate can't take whole are streamed.
+	std::unique_ptr<libdeflate_decompressor, decltype(&libdeflate_free_decompressor)> decompressor(
+		libdeflate_alloc_decompressor(), libdeflate_free_decompressor);
+	libdeflate_decompressor *whole = decompressor.get();
+	modes.push_back({ "whole-entry", [whole](unzFile zipfile, const unz_file_info64& file_info, FILE *out)
+	{
+		if (file_info.compression_method == Z_DEFLATED && (file_info.flag & 1) == 0 && file_info.uncompressed_size <= INFLATE_BUDGET)
+			return inflateWhole(zipfile, file_info, out, whole);
+		return inflateStreamed(zipfile, out);
+	} });
+#else
+	cout << "whole-entry inflate not built. Build with /p:UseLibdeflate=true to include it." << endl;
+#endif
+
+	cout << std::fixed << std::setprecision(1);
+	for (auto& archive : archives)
+	{
+		cout << archive << endl;
+		for (auto& mode : modes)
+		{
+			ZPOS64_T bytes = 0;
+			double seconds = timeArchive(archive, output, runs, mode.inflate, &bytes);
+			cout << "  " << std::left << std::setw(12) << mode.name << std::right;
+			if (seconds < 0.0)
+			{
+				cout << "failed" << endl;
+				continue;
+			}
+
+			double megabytes = bytes / (1024.0 * 1024.0);
+			cout << std::setw(10) << megabytes << " MB  " << std::setw(8) << seconds * 1000.0 << " ms  ";
+			if (seconds > 0.0)
+				cout << std::setw(8) << megabytes / seconds << " MB/s";
+			cout << endl;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,693 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <io.h>
+
+#include "AutoUpdaterLib.h"
+#include "FileHash.h"
+#include "zlib\zlib.h"
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#pragma comment(lib, "ws2_32.lib")
+
+// Fleet load test for the update pipeline.
+// A local HTTP fixture serves the version file and a generated update zip, with shaped
+// latency and a shared bandwidth limit. N clients run the real updater in staging mode on
+// an aligned check schedule. Partway in, the fixture publishes a new version, and the
+// run measures how long the fleet takes to converge on it and the request rate the server
+// sees. The fleet runs once without jitter and once with it, to show the thundering herd.
+//
+// With --mirror-race, one client instead races three fixtures with different latencies
+// listed as mirrors. It checks that the fastest mirror serves the download, that a mirror
+// stalling mid-transfer fails over and resumes on the next one, and that a mirror serving
+// a corrupted artifact is rejected by the published hash. Exits non-zero if any check fails.
+//
+// Usage: LoadTest [--mirror-race] [--clients N] [--payload-kb K] [--latency-ms L] [--bandwidth-mbps B]
+//                 [--interval-ms I] [--release-ms R] [--jitter-ms J] [--timeout-s T]
+
+using std::cout;
+using std::endl;
+using std::string;
+using Clock = std::chrono::steady_clock;
+
+#define OLD_VERSION			"1.0"
+#define NEW_VERSION			"2.0"
+#define SEND_CHUNK_SIZE		(16 * 1024)
+#define RATE_BUCKET_MS		100
+#define STALL_POLL_MS		100
+
+struct LoadTestOptions
+{
+public:
+	int clients = 200;
+	size_t payloadBytes = 1024 * 1024;
+	unsigned int latencyMs = 50;
+	double bandwidthMbps = 100.0;
+	unsigned int intervalMs = 2000;
+	unsigned int releaseMs = 1000;
+	unsigned int jitterMs = 2000;
+	unsigned int timeoutS = 120;
+};
+
+struct FleetResult
+{
+public:
+	int converged = 0;
+	double convergeMs = 0.0;		// Release to the last client staging the new version.
+	double medianMs = 0.0;
+	size_t requests = 0;
+	double peakRate = 0.0;			// Requests per second over the busiest second.
+	double meanRate = 0.0;
+	int peakConnections = 0;
+};
+
+// Local HTTP/1.1 fixture. One request per connection, answered after the configured latency,
+// with every response body paced through a single shared bandwidth budget.
+class FixtureServer
+{
+public:
+	FixtureServer(const LoadTestOptions& options, const string& payload)
+		: m_options(options), m_payload(payload), m_version(OLD_VERSION), m_stallAfter(0), m_corrupt(false),
+		m_socket(INVALID_SOCKET), m_port(0), m_running(false), m_active(0), m_peakActive(0),
+		m_fullDownloads(0), m_resumedDownloads(0), m_requests(0)
+	{
+
+	}
+	~FixtureServer()
+	{
+		stop();
+	}
+
+	bool start()
+	{
+		m_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (m_socket == INVALID_SOCKET)
+			return false;
+
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = 0;
+		int length = sizeof(address);
+		if (bind(m_socket, (sockaddr*)&address, sizeof(address)) != 0 || listen(m_socket, SOMAXCONN) != 0 ||
+			getsockname(m_socket, (sockaddr*)&address, &length) != 0)
+			return false;
+
+		m_port = ntohs(address.sin_port);
+		m_running = true;
+		m_start = Clock::now();
+		m_nextSend = m_start;
+		m_acceptThread = std::thread(&FixtureServer::_Accept, this);
+		return true;
+	}
+
+	void stop()
+	{
+		if (!m_running.exchange(false))
+			return;
+
+		closesocket(m_socket);
+		if (m_acceptThread.joinable())
+			m_acceptThread.join();
+		while (m_active > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	void publish(const string& version)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_version = version;
+	}
+
+	// Mirror race faults. A stalled fixture stops sending the update after the given number
+	// of bytes and holds the connection open. A corrupt one flips a byte in the middle.
+	inline void setStall(size_t after_bytes) { m_stallAfter = after_bytes; }
+	inline void setCorrupt(bool corrupt) { m_corrupt = corrupt; }
+
+	inline int getPort() const { return m_port; }
+	inline int getFullDownloads() const { return m_fullDownloads; }
+	inline int getResumedDownloads() const { return m_resumedDownloads; }
+	inline Clock::time_point getStart() const { return m_start; }
+	inline size_t getRequests() const { return m_requests; }
+	inline int getPeakConnections() const { return m_peakActive; }
+
+	// Busiest and mean requests per second between two points in the run.
+	void getRates(Clock::time_point from, Clock::time_point to, double* peak, double* mean)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t first = (size_t)std::chrono::duration_cast<std::chrono::milliseconds>(from - m_start).count() / RATE_BUCKET_MS;
+		size_t last = (size_t)std::chrono::duration_cast<std::chrono::milliseconds>(to - m_start).count() / RATE_BUCKET_MS;
+		const size_t perSecond = 1000 / RATE_BUCKET_MS;
+
+		size_t total = 0;
+		size_t busiest = 0;
+		for (size_t i = first; i <= last && i < m_buckets.size(); i++)
+		{
+			total += m_buckets[i];
+			size_t window = 0;
+			for (size_t j = i; j < i + perSecond && j < m_buckets.size(); j++)
+				window += m_buckets[j];
+			busiest = (std::max)(busiest, window);
+		}
+
+		double seconds = (std::max)(0.001, std::chrono::duration<double>(to - from).count());
+		*peak = (double)busiest;
+		*mean = total / seconds;
+	}
+
+private:
+	void _Accept()
+	{
+		while (m_running)
+		{
+			SOCKET client = accept(m_socket, NULL, NULL);
+			if (client == INVALID_SOCKET)
+				continue;
+
+			int active = ++m_active;
+			int peak = m_peakActive;
+			while (active > peak && !m_peakActive.compare_exchange_weak(peak, active))
+				;
+
+			std::thread(&FixtureServer::_Serve, this, client).detach();
+		}
+	}
+
+	void _Serve(SOCKET client)
+	{
+		// Read up to the end of the request headers.
+		string request;
+		char buffer[1024];
+		while (request.find("\r\n\r\n") == string::npos)
+		{
+			int read = recv(client, buffer, sizeof(buffer), 0);
+			if (read <= 0)
+				break;
+			request.append(buffer, read);
+		}
+
+		_CountRequest();
+		std::this_thread::sleep_for(std::chrono::milliseconds(m_options.latencyMs));
+
+		std::istringstream line(request);
+		string method, path;
+		line >> method >> path;
+
+		// Resumed downloads ask for "Range: bytes=<offset>-".
+		size_t start = 0;
+		size_t range = request.find("\r\nRange: bytes=");
+		if (range != string::npos)
+			start = (size_t)strtoull(request.c_str() + range + 16, NULL, 10);
+
+		string body;
+		string status = "200 OK";
+		string extra;
+		if (path == "/version")
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			body = m_version;
+		}
+		else if (path == "/update.zip")
+		{
+			body = m_payload;
+			if (m_corrupt && !body.empty())
+				body[body.size() / 2] ^= 0xff;
+
+			if (method != "HEAD" && range != string::npos)
+				m_resumedDownloads++;
+			else if (method != "HEAD")
+				m_fullDownloads++;
+			if (range != string::npos && start < body.size())
+			{
+				status = "206 Partial Content";
+				extra = "Content-Range: bytes " + std::to_string(start) + "-" + std::to_string(body.size() - 1) + "/" +
+					std::to_string(body.size()) + "\r\n";
+				body.erase(0, start);
+			}
+			else
+				start = 0;
+		}
+		else
+			status = "404 Not Found";
+
+		string header = "HTTP/1.1 " + status + "\r\nContent-Length: " + std::to_string(body.size()) +
+			"\r\n" + extra + "Connection: close\r\n\r\n";
+		bool ok = send(client, header.data(), (int)header.size(), 0) == (int)header.size();
+
+		for (size_t offset = 0; ok && method != "HEAD" && offset < body.size(); offset += SEND_CHUNK_SIZE)
+		{
+			if (m_stallAfter > 0 && path == "/update.zip" && start + offset >= m_stallAfter)
+			{
+				_Stall(client);
+				break;
+			}
+
+			int chunk = (int)(std::min)((size_t)SEND_CHUNK_SIZE, body.size() - offset);
+			std::this_thread::sleep_until(_ReserveBandwidth(chunk));
+			ok = send(client, body.data() + offset, chunk, 0) == chunk;
+		}
+
+		shutdown(client, SD_SEND);
+		closesocket(client);
+		--m_active;
+	}
+
+	// Holds the connection without sending until the client gives up on it or the server stops.
+	void _Stall(SOCKET client)
+	{
+		DWORD timeout = STALL_POLL_MS;
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+
+		char buffer[256];
+		while (m_running)
+		{
+			int read = recv(client, buffer, sizeof(buffer), 0);
+			if (read == 0 || (read < 0 && WSAGetLastError() != WSAETIMEDOUT))
+				return;
+		}
+	}
+
+	// Every response shares one link, so each chunk is given the next free slot on it.
+	Clock::time_point _ReserveBandwidth(int bytes)
+	{
+		const double bytesPerSecond = m_options.bandwidthMbps * 1000.0 * 1000.0 / 8.0;
+		auto duration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(bytes / bytesPerSecond));
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Clock::time_point slot = (std::max)(Clock::now(), m_nextSend);
+		m_nextSend = slot + duration;
+		return slot;
+	}
+
+	void _CountRequest()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t bucket = (size_t)std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - m_start).count() / RATE_BUCKET_MS;
+		if (bucket >= m_buckets.size())
+			m_buckets.resize(bucket + 1, 0);
+		m_buckets[bucket]++;
+		m_requests++;
+	}
+
+	const LoadTestOptions& m_options;
+	const string& m_payload;
+	string m_version;
+	size_t m_stallAfter;
+	bool m_corrupt;
+
+	SOCKET m_socket;
+	int m_port;
+	std::thread m_acceptThread;
+	std::atomic<bool> m_running;
+	std::atomic<int> m_active;
+	std::atomic<int> m_peakActive;
+	std::atomic<int> m_fullDownloads;
+	std::atomic<int> m_resumedDownloads;
+
+	std::mutex m_mutex;
+	Clock::time_point m_start;
+	Clock::time_point m_nextSend;
+	std::vector<size_t> m_buckets;
+	size_t m_requests;
+};
+
+// Silences the updater's console output while the fleet runs.
+class QuietOutput
+{
+public:
+	QuietOutput()
+	{
+		fflush(stdout);
+		fflush(stderr);
+		m_stdout = _dup(_fileno(stdout));
+		m_stderr = _dup(_fileno(stderr));
+		FILE *null = NULL;
+		freopen_s(&null, "NUL", "w", stdout);
+		freopen_s(&null, "NUL", "w", stderr);
+	}
+	~QuietOutput()
+	{
+		fflush(stdout);
+		fflush(stderr);
+		_dup2(m_stdout, _fileno(stdout));
+		_dup2(m_stderr, _fileno(stderr));
+		_close(m_stdout);
+		_close(m_stderr);
+	}
+
+private:
+	int m_stdout;
+	int m_stderr;
+};
+
+static void _WriteLE(string* out, uint32_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+		out->push_back((char)((value >> (8 * i)) & 0xff));
+}
+
+// Builds a stored (uncompressed) zip in the layout of a GitHub archive: a root folder
+// entry followed by one file of random bytes inside it.
+static string _MakeUpdateZip(size_t payload_bytes)
+{
+	std::mt19937 random(1234);
+	string data(payload_bytes, '\0');
+	for (auto& c : data)
+		c = (char)(random() & 0xff);
+
+	struct Entry { string name; string data; uint32_t offset; };
+	std::vector<Entry> entries = { { "update/", "", 0 }, { "update/payload.bin", data, 0 } };
+
+	string zip;
+	for (auto& entry : entries)
+	{
+		entry.offset = (uint32_t)zip.size();
+		uint32_t crc = crc32(0L, (const Bytef*)entry.data.data(), (uInt)entry.data.size());
+		_WriteLE(&zip, 0x04034b50, 4);
+		_WriteLE(&zip, 20, 2);						// Version needed.
+		_WriteLE(&zip, 0, 2);						// Flags.
+		_WriteLE(&zip, 0, 2);						// Stored.
+		_WriteLE(&zip, 0, 2);						// Time.
+		_WriteLE(&zip, 0x21, 2);					// Date, 1980-01-01.
+		_WriteLE(&zip, crc, 4);
+		_WriteLE(&zip, (uint32_t)entry.data.size(), 4);
+		_WriteLE(&zip, (uint32_t)entry.data.size(), 4);
+		_WriteLE(&zip, (uint32_t)entry.name.size(), 2);
+		_WriteLE(&zip, 0, 2);
+		zip += entry.name;
+		zip += entry.data;
+	}
+
+	uint32_t directoryOffset = (uint32_t)zip.size();
+	for (auto& entry : entries)
+	{
+		uint32_t crc = crc32(0L, (const Bytef*)entry.data.data(), (uInt)entry.data.size());
+		_WriteLE(&zip, 0x02014b50, 4);
+		_WriteLE(&zip, 20, 2);						// Version made by.
+		_WriteLE(&zip, 20, 2);						// Version needed.
+		_WriteLE(&zip, 0, 2);
+		_WriteLE(&zip, 0, 2);
+		_WriteLE(&zip, 0, 2);
+		_WriteLE(&zip, 0x21, 2);
+		_WriteLE(&zip, crc, 4);
+		_WriteLE(&zip, (uint32_t)entry.data.size(), 4);
+		_WriteLE(&zip, (uint32_t)entry.data.size(), 4);
+		_WriteLE(&zip, (uint32_t)entry.name.size(), 2);
+		_WriteLE(&zip, 0, 2);						// Extra length.
+		_WriteLE(&zip, 0, 2);						// Comment length.
+		_WriteLE(&zip, 0, 2);						// Disk.
+		_WriteLE(&zip, 0, 2);						// Internal attributes.
+		_WriteLE(&zip, entry.name.back() == '/' ? 0x10 : 0, 4);
+		_WriteLE(&zip, entry.offset, 4);
+		zip += entry.name;
+	}
+	uint32_t directorySize = (uint32_t)zip.size() - directoryOffset;
+
+	_WriteLE(&zip, 0x06054b50, 4);
+	_WriteLE(&zip, 0, 2);
+	_WriteLE(&zip, 0, 2);
+	_WriteLE(&zip, (uint32_t)entries.size(), 2);
+	_WriteLE(&zip, (uint32_t)entries.size(), 2);
+	_WriteLE(&zip, directorySize, 4);
+	_WriteLE(&zip, directoryOffset, 4);
+	_WriteLE(&zip, 0, 2);
+	return zip;
+}
+
+// One updater instance. Checks on the shared schedule until it has staged the new version.
+static void _RunClient(int id, const LoadTestOptions& options, unsigned int jitter_ms, const string& base_url,
+	const fs::path& root, Clock::time_point start, Clock::time_point deadline, Clock::time_point* staged)
+{
+	fs::path directory = root / ("client" + std::to_string(id));
+	std::error_code ec;
+	fs::create_directories(directory, ec);
+	string process = (directory / "client.exe").string();
+
+	UpdaterSettings settings;
+	settings.stageOnly = true;
+	settings.checkJitterMs = jitter_ms;
+
+	for (Clock::time_point next = start; next < deadline; next += std::chrono::milliseconds(options.intervalMs))
+	{
+		std::this_thread::sleep_until(next);
+
+		AutoUpdater updater(Version(OLD_VERSION), base_url + "/version", base_url + "/update.zip", process.c_str(), settings);
+		string version;
+		if (AutoUpdater::readStagedMarker(updater.getDownloadDIR(), &version, NULL, NULL) && version == NEW_VERSION)
+		{
+			*staged = Clock::now();
+			return;
+		}
+	}
+}
+
+static FleetResult _RunFleet(const LoadTestOptions& options, unsigned int jitter_ms, const string& payload, const fs::path& root)
+{
+	FleetResult result;
+	std::error_code ec;
+	fs::remove_all(root, ec);
+
+	FixtureServer server(options, payload);
+	if (!server.start())
+	{
+		std::cerr << "Could not start the fixture server." << endl;
+		return result;
+	}
+	string baseURL = "http://127.0.0.1:" + std::to_string(server.getPort());
+
+	Clock::time_point start = Clock::now();
+	Clock::time_point release = start + std::chrono::milliseconds(options.releaseMs);
+	Clock::time_point deadline = start + std::chrono::seconds(options.timeoutS);
+	std::vector<Clock::time_point> staged(options.clients, Clock::time_point());
+	{
+		QuietOutput quiet;
+		std::vector<std::thread> clients;
+		for (int i = 0; i < options.clients; i++)
+			clients.emplace_back(_RunClient, i, std::cref(options), jitter_ms, std::cref(baseURL), std::cref(root), start, deadline, &staged[i]);
+
+		std::this_thread::sleep_until(release);
+		server.publish(NEW_VERSION);
+
+		for (auto& client : clients)
+			client.join();
+	}
+
+	std::vector<double> times;
+	Clock::time_point last = release;
+	for (auto& time : staged)
+	{
+		if (time == Clock::time_point())
+			continue;
+		times.push_back(std::chrono::duration<double, std::milli>(time - release).count());
+		last = (std::max)(last, time);
+	}
+	std::sort(times.begin(), times.end());
+
+	result.converged = (int)times.size();
+	result.convergeMs = times.empty() ? 0.0 : times.back();
+	result.medianMs = times.empty() ? 0.0 : times[times.size() / 2];
+	result.requests = server.getRequests();
+	result.peakConnections = server.getPeakConnections();
+	server.getRates(release, last, &result.peakRate, &result.meanRate);
+
+	server.stop();
+	fs::remove_all(root, ec);
+	return result;
+}
+
+// Mirror race scenarios. Fixture 0 is slow, 1 fast and 2 in between. Each scenario stages
+// the update once with a fresh client and returns whether the checks passed.
+enum MirrorScenario
+{
+	MIRROR_FASTEST_WINS,
+	MIRROR_STALL_FAILOVER,
+	MIRROR_CORRUPT_REJECTED
+};
+
+static bool _RunMirrorScenario(MirrorScenario scenario, const LoadTestOptions& options, const string& payload, const fs::path& root)
+{
+	std::error_code ec;
+	fs::remove_all(root, ec);
+	fs::create_directories(root, ec);
+
+	const unsigned int latencies[] = { 600, 20, 300 };
+	std::vector<LoadTestOptions> mirrorOptions(3, options);
+	std::vector<std::unique_ptr<FixtureServer>> servers;
+	for (size_t i = 0; i < mirrorOptions.size(); i++)
+	{
+		mirrorOptions[i].latencyMs = latencies[i];
+		servers.emplace_back(new FixtureServer(mirrorOptions[i], payload));
+		if (!servers.back()->start())
+		{
+			std::cerr << "Could not start the fixture server." << endl;
+			return false;
+		}
+	}
+
+	if (scenario == MIRROR_STALL_FAILOVER)
+		servers[1]->setStall(payload.size() / 2);
+	else if (scenario == MIRROR_CORRUPT_REJECTED)
+		servers[1]->setCorrupt(true);
+
+	// The version file lists every fixture as a mirror, slowest first, with the artifact's hash.
+	Sha256 hash;
+	unsigned char digest[SHA256_SIZE];
+	hash.update(payload.data(), payload.size());
+	hash.finish(digest);
+	std::vector<string> urls;
+	string versionFile = string(NEW_VERSION) + "\n" + ARTIFACT_HASH_PREFIX + Sha256::toHex(digest) + "\n";
+	for (auto& server : servers)
+	{
+		urls.push_back("http://127.0.0.1:" + std::to_string(server->getPort()) + "/update.zip");
+		versionFile += urls.back() + "\n";
+	}
+	for (auto& server : servers)
+		server->publish(versionFile);
+
+	UpdaterSettings settings;
+	settings.stageOnly = true;
+	settings.mirrorLowSpeedLimit = 1024;
+	settings.mirrorLowSpeedTime = 1;
+
+	string process = (root / "client.exe").string();
+	string versionURL = "http://127.0.0.1:" + std::to_string(servers[0]->getPort()) + "/version";
+	string version;
+	bool hashRejected = false;
+	{
+		QuietOutput quiet;
+		AutoUpdater updater(Version(OLD_VERSION), versionURL, urls[0], process.c_str(), settings);
+		AutoUpdater::readStagedMarker(updater.getDownloadDIR(), &version, NULL, NULL);
+		for (auto flag : updater.getFlags())
+			hashRejected |= flag->getError() == DU_HASH_ERROR;
+	}
+
+	const bool staged = version == NEW_VERSION;
+	const int slowFull = servers[0]->getFullDownloads() + servers[2]->getFullDownloads();
+	const int resumed = servers[0]->getResumedDownloads() + servers[2]->getResumedDownloads();
+	bool passed = false;
+	switch (scenario)
+	{
+	case MIRROR_FASTEST_WINS:
+		// Only the fastest mirror is downloaded from.
+		passed = staged && servers[1]->getFullDownloads() == 1 && slowFull == 0 && resumed == 0;
+		cout << "Fastest mirror wins" << endl;
+		break;
+	case MIRROR_STALL_FAILOVER:
+		// The stalled download is picked up from its offset on another mirror, not restarted.
+		passed = staged && servers[1]->getFullDownloads() == 1 && slowFull == 0 && resumed == 1;
+		cout << "Stalled mirror fails over and resumes" << endl;
+		break;
+	case MIRROR_CORRUPT_REJECTED:
+		// A download that doesn't match the published hash is never staged.
+		passed = !staged && hashRejected && servers[1]->getFullDownloads() == 1;
+		cout << "Corrupt mirror rejected" << endl;
+		break;
+	}
+
+	cout << "  downloads         fast " << servers[1]->getFullDownloads() << ", others " << slowFull
+		<< ", resumed " << resumed << endl
+		<< "  staged            " << (staged ? version : "nothing") << endl
+		<< "  result            " << (passed ? "PASS" : "FAIL") << endl;
+
+	for (auto& server : servers)
+		server->stop();
+	fs::remove_all(root, ec);
+	return passed;
+}
+
+static void _PrintResult(const char* name, const LoadTestOptions& options, const FleetResult& result)
+{
+	cout << name << endl
+		<< "  converged         " << result.converged << " of " << options.clients << " clients" << endl
+		<< "  convergence       " << result.convergeMs << " ms after release (median " << result.medianMs << " ms)" << endl
+		<< "  requests          " << result.requests << endl
+		<< "  request rate      peak " << result.peakRate << "/s, mean " << result.meanRate << "/s after release" << endl
+		<< "  peak connections  " << result.peakConnections << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	LoadTestOptions options;
+	const bool mirrorRace = argc > 1 && string(argv[1]) == "--mirror-race";
+	for (int i = mirrorRace ? 2 : 1; i + 1 < argc; i += 2)
+	{
+		string arg(argv[i]);
+		double value = atof(argv[i + 1]);
+		if (arg == "--clients")
+			options.clients = (std::max)(1, (int)value);
+		else if (arg == "--payload-kb")
+			options.payloadBytes = (size_t)(value * 1024);
+		else if (arg == "--latency-ms")
+			options.latencyMs = (unsigned int)value;
+		else if (arg == "--bandwidth-mbps")
+			options.bandwidthMbps = (std::max)(0.001, value);
+		else if (arg == "--interval-ms")
+			options.intervalMs = (std::max)(1u, (unsigned int)value);
+		else if (arg == "--release-ms")
+			options.releaseMs = (unsigned int)value;
+		else if (arg == "--jitter-ms")
+			options.jitterMs = (unsigned int)value;
+		else if (arg == "--timeout-s")
+			options.timeoutS = (unsigned int)value;
+		else
+		{
+			std::cerr << "Unknown option " << arg << endl;
+			return 1;
+		}
+	}
+
+	WSADATA wsa;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+		return 1;
+	curl_global_init(CURL_GLOBAL_ALL);
+
+	string payload = _MakeUpdateZip(options.payloadBytes);
+	fs::path root = fs::temp_directory_path() / "AutoUpdaterLoadTest";
+
+	if (mirrorRace)
+	{
+		cout << "Mirror race, " << options.payloadBytes / 1024 << " KB update, " << options.bandwidthMbps
+			<< " Mbit/s per mirror" << endl << endl;
+
+		bool passed = _RunMirrorScenario(MIRROR_FASTEST_WINS, options, payload, root);
+		cout << endl;
+		passed &= _RunMirrorScenario(MIRROR_STALL_FAILOVER, options, payload, root);
+		cout << endl;
+		passed &= _RunMirrorScenario(MIRROR_CORRUPT_REJECTED, options, payload, root);
+
+		curl_global_cleanup();
+		WSACleanup();
+		return passed ? 0 : 1;
+	}
+
+	cout << std::fixed << std::setprecision(1)
+		<< options.clients << " clients, " << options.payloadBytes / 1024 << " KB update, "
+		<< options.latencyMs << " ms latency, " << options.bandwidthMbps << " Mbit/s, checking every "
+		<< options.intervalMs << " ms" << endl << endl;
+
+	FleetResult aligned = _RunFleet(options, 0, payload, root);
+	_PrintResult("No jitter", options, aligned);
+	cout << endl;
+
+	FleetResult jittered = _RunFleet(options, options.jitterMs, payload, root);
+	_PrintResult(("Jitter up to " + std::to_string(options.jitterMs) + " ms").c_str(), options, jittered);
+
+	curl_global_cleanup();
+	WSACleanup();
+	return 0;
+}
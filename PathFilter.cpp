@@ -0,0 +1,228 @@
+#include "PathFilter.h"
+
+#include <algorithm>
+
+GlobSet::GlobSet()
+	: m_empty(true)
+{
+
+}
+
+GlobSet::~GlobSet()
+{
+
+}
+
+void GlobSet::add(const string& pattern)
+{
+	string glob(pattern);
+	std::replace(glob.begin(), glob.end(), '\\', '/');
+	while (!glob.empty() && glob.back() == '/')
+		glob.pop_back();
+	while (!glob.empty() && glob.front() == '/')
+		glob.erase(0, 1);
+	if (glob.empty())
+		return;
+
+	m_empty = false;
+
+	// Single segment patterns.
+	if (glob.find('/') == string::npos)
+	{
+		if (!_HasWildcard(glob))
+			m_names.insert(glob);
+		else if (glob.size() > 2 && glob[0] == '*' && glob[1] == '.' && !_HasWildcard(glob.substr(1)))
+			m_extensions.insert(glob.substr(1));
+		else
+			m_segmentGlobs.push_back(glob);
+		return;
+	}
+
+	// Split into segments.
+	std::vector<string> segments;
+	size_t start = 0;
+	while (start <= glob.size())
+	{
+		size_t end = glob.find('/', start);
+		if (end == string::npos)
+			end = glob.size();
+		segments.push_back(glob.substr(start, end - start));
+		start = end + 1;
+	}
+
+	// Literal directories ending in "**" (or nothing) go in the prefix trie.
+	bool literalPrefix = true;
+	for (size_t i = 0; i < segments.size(); i++)
+	{
+		bool last = (i + 1 == segments.size());
+		if (_HasWildcard(segments[i]) && !(last && segments[i] == "**"))
+			literalPrefix = false;
+	}
+
+	if (literalPrefix)
+	{
+		TrieNode *node = &m_prefixes;
+		for (auto& segment : segments)
+		{
+			if (segment == "**")
+				break;
+
+			auto& child = node->children[segment];
+			if (!child)
+				child.reset(new TrieNode());
+			node = child.get();
+		}
+		node->terminal = true;
+		return;
+	}
+
+	m_pathGlobs.push_back(segments);
+}
+
+bool GlobSet::matches(const std::vector<string>& segments) const
+{
+	if (m_empty)
+		return false;
+
+	// Any segment matching a single segment pattern.
+	for (auto& segment : segments)
+	{
+		if (m_names.count(segment) != 0)
+			return true;
+
+		if (!m_extensions.empty())
+		{
+			for (size_t dot = segment.find('.'); dot != string::npos; dot = segment.find('.', dot + 1))
+			{
+				if (m_extensions.count(segment.substr(dot)) != 0)
+					return true;
+			}
+		}
+
+		for (auto& glob : m_segmentGlobs)
+		{
+			if (_MatchSegment(glob.c_str(), segment.c_str()))
+				return true;
+		}
+	}
+
+	// A literal directory prefix.
+	const TrieNode *node = &m_prefixes;
+	for (auto& segment : segments)
+	{
+		auto iter = node->children.find(segment);
+		if (iter == node->children.end())
+			break;
+
+		node = iter->second.get();
+		if (node->terminal)
+			return true;
+	}
+
+	// General path globs.
+	for (auto& glob : m_pathGlobs)
+	{
+		if (_MatchPath(glob, 0, segments, 0))
+			return true;
+	}
+
+	return false;
+}
+
+bool GlobSet::_HasWildcard(const string& text)
+{
+	return text.find_first_of("*?") != string::npos;
+}
+
+bool GlobSet::_MatchSegment(const char* pattern, const char* text)
+{
+	// Iterative '*' and '?' matching with single-star backtracking.
+	const char *star = NULL;
+	const char *resume = NULL;
+	while (*text != '\0')
+	{
+		if (*pattern == '?' || *pattern == *text)
+		{
+			pattern++;
+			text++;
+		}
+		else if (*pattern == '*')
+		{
+			star = pattern++;
+			resume = text;
+		}
+		else if (star != NULL)
+		{
+			pattern = star + 1;
+			text = ++resume;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	while (*pattern == '*')
+		pattern++;
+	return *pattern == '\0';
+}
+
+bool GlobSet::_MatchPath(const std::vector<string>& pattern, size_t p, const std::vector<string>& path, size_t s)
+{
+	if (p == pattern.size())
+		return s == path.size();
+
+	// "**" matches zero or more whole segments.
+	if (pattern[p] == "**")
+	{
+		for (size_t skip = s; skip <= path.size(); skip++)
+		{
+			if (_MatchPath(pattern, p + 1, path, skip))
+				return true;
+		}
+		return false;
+	}
+
+	return s < path.size() && _MatchSegment(pattern[p].c_str(), path[s].c_str()) && _MatchPath(pattern, p + 1, path, s + 1);
+}
+
+PathFilter::PathFilter(const std::vector<string>& include_rules, const std::vector<string>& exclude_rules)
+{
+	for (auto& rule : include_rules)
+		m_include.add(rule);
+	for (auto& rule : exclude_rules)
+		m_exclude.add(rule);
+}
+
+PathFilter::~PathFilter()
+{
+
+}
+
+bool PathFilter::accepts(const string& path, bool is_directory) const
+{
+	std::vector<string> segments = _Split(path);
+	if (segments.empty())
+		return true;
+
+	if (m_exclude.matches(segments))
+		return false;
+
+	return is_directory || m_include.empty() || m_include.matches(segments);
+}
+
+std::vector<string> PathFilter::_Split(const string& path)
+{
+	std::vector<string> segments;
+	size_t start = 0;
+	while (start < path.size())
+	{
+		size_t end = path.find_first_of("/\\", start);
+		if (end == string::npos)
+			end = path.size();
+		if (end > start)
+			segments.push_back(path.substr(start, end - start));
+		start = end + 1;
+	}
+	return segments;
+}
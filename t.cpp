@@ -0,0 +1,10 @@
+#include "PathFilter.h"
+#include <cstdio>
+int main(){
+ PathFilter f({}, {"AutoUpdater.cpp","*.md","docs/**","bin/linux/**","src/*/test/*.cpp",".git","**/tmp/*.o"});
+ const char* ps[]={"README.md","a/b/AutoUpdater.cpp","docs","docs/x.txt","bin/linux/a.so","bin/windows/a.dll","src/x/test/a.cpp","src/x/test/a.h",".git/config","a/tmp/b.o","tmp/b.o","main.cpp"};
+ for(auto p:ps) printf("%-22s %d\n",p,f.accepts(p,false));
+ PathFilter g({"bin/windows/**","*.exe"},{});
+ const char* qs[]={"bin/windows/a.dll","bin/linux/a.so","x.exe","bin"};
+ for(auto p:qs) printf("%-22s %d\n",p,g.accepts(p,false));
+}